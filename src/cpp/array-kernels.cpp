@@ -0,0 +1,437 @@
+#include "array-kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#   define EFFIL_X86_KERNELS
+#   define EFFIL_TARGET(isa) __attribute__((target(isa)))
+#   include <immintrin.h>
+#endif
+
+namespace effil {
+namespace kernels {
+
+namespace {
+
+#ifdef EFFIL_X86_KERNELS
+
+enum class Isa {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+Isa detectIsa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return Isa::SSE2;
+    return Isa::Scalar;
+}
+
+const Isa isa = detectIsa();
+
+// All loads and stores are unaligned: arrays are allocated as plain char buffers.
+// Reductions over float elements are accumulated in double lanes.
+// FMA isn't used, so element-wise kernels round exactly as the scalar versions do.
+
+// Completes vectorized minmax over the tail of data.
+// Data containing NaN is scanned again by the scalar version to get the same NaN.
+template <typename T>
+bool finishMinmax(bool nanMet, const T* data, size_t size, size_t tail, T& min, T& max) {
+    if (nanMet)
+        return kernels::minmax<T>(data, size, min, max);
+    T tailMin, tailMax;
+    if (kernels::minmax<T>(data + tail, size - tail, tailMin, tailMax)) {
+        if (tailMin != tailMin) {
+            min = max = tailMin;
+            return true;
+        }
+        min = std::min(min, tailMin);
+        max = std::max(max, tailMax);
+    }
+    return true;
+}
+
+namespace sse2 {
+
+EFFIL_TARGET("sse2")
+double horizontalSum(__m128d v) {
+    double lanes[2];
+    _mm_storeu_pd(lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+EFFIL_TARGET("sse2")
+double sum(const double* data, size_t size) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(data + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(data + i + 2));
+    }
+    double result = horizontalSum(_mm_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += data[i];
+    return result;
+}
+
+EFFIL_TARGET("sse2")
+double sum(const float* data, size_t size) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 v = _mm_loadu_ps(data + i);
+        acc0 = _mm_add_pd(acc0, _mm_cvtps_pd(v));
+        acc1 = _mm_add_pd(acc1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+    }
+    double result = horizontalSum(_mm_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += data[i];
+    return result;
+}
+
+EFFIL_TARGET("sse2")
+bool minmax(const double* data, size_t size, double& min, double& max) {
+    if (size == 0)
+        return false;
+    __m128d vmin = _mm_set1_pd(data[0]);
+    __m128d vmax = vmin;
+    __m128d nan = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2) {
+        const __m128d v = _mm_loadu_pd(data + i);
+        vmin = _mm_min_pd(vmin, v);
+        vmax = _mm_max_pd(vmax, v);
+        nan = _mm_or_pd(nan, _mm_cmpunord_pd(v, v));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, vmin);
+    min = std::min(lanes[0], lanes[1]);
+    _mm_storeu_pd(lanes, vmax);
+    max = std::max(lanes[0], lanes[1]);
+    return finishMinmax(_mm_movemask_pd(nan) != 0, data, size, i, min, max);
+}
+
+EFFIL_TARGET("sse2")
+bool minmax(const float* data, size_t size, float& min, float& max) {
+    if (size == 0)
+        return false;
+    __m128 vmin = _mm_set1_ps(data[0]);
+    __m128 vmax = vmin;
+    __m128 nan = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 v = _mm_loadu_ps(data + i);
+        vmin = _mm_min_ps(vmin, v);
+        vmax = _mm_max_ps(vmax, v);
+        nan = _mm_or_ps(nan, _mm_cmpunord_ps(v, v));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, vmin);
+    min = std::min({lanes[0], lanes[1], lanes[2], lanes[3]});
+    _mm_storeu_ps(lanes, vmax);
+    max = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+    return finishMinmax(_mm_movemask_ps(nan) != 0, data, size, i, min, max);
+}
+
+EFFIL_TARGET("sse2")
+double dot(const double* x, const double* y, size_t size) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+    double result = horizontalSum(_mm_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += x[i] * y[i];
+    return result;
+}
+
+EFFIL_TARGET("sse2")
+double dot(const float* x, const float* y, size_t size) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m128 vx = _mm_loadu_ps(x + i);
+        const __m128 vy = _mm_loadu_ps(y + i);
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_cvtps_pd(vx), _mm_cvtps_pd(vy)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(vx, vx)),
+                                           _mm_cvtps_pd(_mm_movehl_ps(vy, vy))));
+    }
+    double result = horizontalSum(_mm_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += static_cast<double>(x[i]) * static_cast<double>(y[i]);
+    return result;
+}
+
+EFFIL_TARGET("sse2")
+void axpy(double alpha, const double* x, double* y, size_t size) {
+    const __m128d a = _mm_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2)
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_mul_pd(a, _mm_loadu_pd(x + i)), _mm_loadu_pd(y + i)));
+    for (; i < size; ++i)
+        y[i] = alpha * x[i] + y[i];
+}
+
+EFFIL_TARGET("sse2")
+void axpy(float alpha, const float* x, float* y, size_t size) {
+    const __m128 a = _mm_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(a, _mm_loadu_ps(x + i)), _mm_loadu_ps(y + i)));
+    for (; i < size; ++i)
+        y[i] = alpha * x[i] + y[i];
+}
+
+EFFIL_TARGET("sse2")
+void scale(double* data, size_t size, double alpha) {
+    const __m128d a = _mm_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2)
+        _mm_storeu_pd(data + i, _mm_mul_pd(a, _mm_loadu_pd(data + i)));
+    for (; i < size; ++i)
+        data[i] *= alpha;
+}
+
+EFFIL_TARGET("sse2")
+void scale(float* data, size_t size, float alpha) {
+    const __m128 a = _mm_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm_storeu_ps(data + i, _mm_mul_ps(a, _mm_loadu_ps(data + i)));
+    for (; i < size; ++i)
+        data[i] *= alpha;
+}
+
+} // namespace sse2
+
+namespace avx2 {
+
+EFFIL_TARGET("avx2")
+double horizontalSum(__m256d v) {
+    double lanes[4];
+    _mm256_storeu_pd(lanes, v);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+EFFIL_TARGET("avx2")
+double sum(const double* data, size_t size) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(data + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(data + i + 4));
+    }
+    double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += data[i];
+    return result;
+}
+
+EFFIL_TARGET("avx2")
+double sum(const float* data, size_t size) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 v = _mm256_loadu_ps(data + i);
+        acc0 = _mm256_add_pd(acc0, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+        acc1 = _mm256_add_pd(acc1, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+    }
+    double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += data[i];
+    return result;
+}
+
+EFFIL_TARGET("avx2")
+bool minmax(const double* data, size_t size, double& min, double& max) {
+    if (size == 0)
+        return false;
+    __m256d vmin = _mm256_set1_pd(data[0]);
+    __m256d vmax = vmin;
+    __m256d nan = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        const __m256d v = _mm256_loadu_pd(data + i);
+        vmin = _mm256_min_pd(vmin, v);
+        vmax = _mm256_max_pd(vmax, v);
+        nan = _mm256_or_pd(nan, _mm256_cmp_pd(v, v, _CMP_UNORD_Q));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, vmin);
+    min = std::min({lanes[0], lanes[1], lanes[2], lanes[3]});
+    _mm256_storeu_pd(lanes, vmax);
+    max = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+    return finishMinmax(_mm256_movemask_pd(nan) != 0, data, size, i, min, max);
+}
+
+EFFIL_TARGET("avx2")
+bool minmax(const float* data, size_t size, float& min, float& max) {
+    if (size == 0)
+        return false;
+    __m256 vmin = _mm256_set1_ps(data[0]);
+    __m256 vmax = vmin;
+    __m256 nan = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 v = _mm256_loadu_ps(data + i);
+        vmin = _mm256_min_ps(vmin, v);
+        vmax = _mm256_max_ps(vmax, v);
+        nan = _mm256_or_ps(nan, _mm256_cmp_ps(v, v, _CMP_UNORD_Q));
+    }
+    float lanes[8];
+    _mm256_storeu_ps(lanes, vmin);
+    min = *std::min_element(lanes, lanes + 8);
+    _mm256_storeu_ps(lanes, vmax);
+    max = *std::max_element(lanes, lanes + 8);
+    return finishMinmax(_mm256_movemask_ps(nan) != 0, data, size, i, min, max);
+}
+
+EFFIL_TARGET("avx2")
+double dot(const double* x, const double* y, size_t size) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+    }
+    double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += x[i] * y[i];
+    return result;
+}
+
+EFFIL_TARGET("avx2")
+double dot(const float* x, const float* y, size_t size) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 vx = _mm256_loadu_ps(x + i);
+        const __m256 vy = _mm256_loadu_ps(y + i);
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(vx)),
+                                                 _mm256_cvtps_pd(_mm256_castps256_ps128(vy))));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(vx, 1)),
+                                                 _mm256_cvtps_pd(_mm256_extractf128_ps(vy, 1))));
+    }
+    double result = horizontalSum(_mm256_add_pd(acc0, acc1));
+    for (; i < size; ++i)
+        result += static_cast<double>(x[i]) * static_cast<double>(y[i]);
+    return result;
+}
+
+EFFIL_TARGET("avx2")
+void axpy(double alpha, const double* x, double* y, size_t size) {
+    const __m256d a = _mm256_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_mul_pd(a, _mm256_loadu_pd(x + i)), _mm256_loadu_pd(y + i)));
+    for (; i < size; ++i)
+        y[i] = alpha * x[i] + y[i];
+}
+
+EFFIL_TARGET("avx2")
+void axpy(float alpha, const float* x, float* y, size_t size) {
+    const __m256 a = _mm256_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+        _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_mul_ps(a, _mm256_loadu_ps(x + i)), _mm256_loadu_ps(y + i)));
+    for (; i < size; ++i)
+        y[i] = alpha * x[i] + y[i];
+}
+
+EFFIL_TARGET("avx2")
+void scale(double* data, size_t size, double alpha) {
+    const __m256d a = _mm256_set1_pd(alpha);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        _mm256_storeu_pd(data + i, _mm256_mul_pd(a, _mm256_loadu_pd(data + i)));
+    for (; i < size; ++i)
+        data[i] *= alpha;
+}
+
+EFFIL_TARGET("avx2")
+void scale(float* data, size_t size, float alpha) {
+    const __m256 a = _mm256_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+        _mm256_storeu_ps(data + i, _mm256_mul_ps(a, _mm256_loadu_ps(data + i)));
+    for (; i < size; ++i)
+        data[i] *= alpha;
+}
+
+} // namespace avx2
+
+#   define EFFIL_DISPATCH(kernel, ...) \
+        switch (isa) { \
+            case Isa::AVX2: return avx2::kernel(__VA_ARGS__); \
+            case Isa::SSE2: return sse2::kernel(__VA_ARGS__); \
+            case Isa::Scalar: break; \
+        }
+#else
+#   define EFFIL_DISPATCH(kernel, ...)
+#endif // EFFIL_X86_KERNELS
+
+} // namespace
+
+double sum(const double* data, size_t size) {
+    EFFIL_DISPATCH(sum, data, size);
+    return sum<double>(data, size);
+}
+
+double sum(const float* data, size_t size) {
+    EFFIL_DISPATCH(sum, data, size);
+    return sum<float>(data, size);
+}
+
+bool minmax(const double* data, size_t size, double& min, double& max) {
+    EFFIL_DISPATCH(minmax, data, size, min, max);
+    return minmax<double>(data, size, min, max);
+}
+
+bool minmax(const float* data, size_t size, float& min, float& max) {
+    EFFIL_DISPATCH(minmax, data, size, min, max);
+    return minmax<float>(data, size, min, max);
+}
+
+double dot(const double* x, const double* y, size_t size) {
+    EFFIL_DISPATCH(dot, x, y, size);
+    return dot<double>(x, y, size);
+}
+
+double dot(const float* x, const float* y, size_t size) {
+    EFFIL_DISPATCH(dot, x, y, size);
+    return dot<float>(x, y, size);
+}
+
+void axpy(double alpha, const double* x, double* y, size_t size) {
+    EFFIL_DISPATCH(axpy, alpha, x, y, size);
+    axpy<double>(alpha, x, y, size);
+}
+
+void axpy(float alpha, const float* x, float* y, size_t size) {
+    EFFIL_DISPATCH(axpy, alpha, x, y, size);
+    axpy<float>(alpha, x, y, size);
+}
+
+void scale(double* data, size_t size, double alpha) {
+    EFFIL_DISPATCH(scale, data, size, alpha);
+    scale<double>(data, size, alpha);
+}
+
+void scale(float* data, size_t size, float alpha) {
+    EFFIL_DISPATCH(scale, data, size, alpha);
+    scale<float>(data, size, alpha);
+}
+
+} // namespace kernels
+} // namespace effil
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+
+namespace effil {
+namespace kernels {
+
+// Generic scalar versions, used for integer elements.
+// Non-template overloads below are vectorized for floating point elements.
+
+template <typename T>
+double sum(const T* data, size_t size) {
+    double result = 0;
+    for (size_t i = 0; i < size; ++i)
+        result += static_cast<double>(data[i]);
+    return result;
+}
+
+// Returns false for empty data.
+// NaN propagates: both bounds are the first NaN met in data.
+template <typename T>
+bool minmax(const T* data, size_t size, T& min, T& max) {
+    if (size == 0)
+        return false;
+    min = max = data[0];
+    for (size_t i = 0; i < size; ++i) {
+        // Only NaN isn't equal to itself, integers never take this branch
+        if (data[i] != data[i]) {
+            min = max = data[i];
+            return true;
+        }
+        min = std::min(min, data[i]);
+        max = std::max(max, data[i]);
+    }
+    return true;
+}
+
+template <typename T>
+double dot(const T* x, const T* y, size_t size) {
+    double result = 0;
+    for (size_t i = 0; i < size; ++i)
+        result += static_cast<double>(x[i]) * static_cast<double>(y[i]);
+    return result;
+}
+
+// y = alpha * x + y
+template <typename T>
+void axpy(T alpha, const T* x, T* y, size_t size) {
+    for (size_t i = 0; i < size; ++i)
+        y[i] = alpha * x[i] + y[i];
+}
+
+template <typename T>
+void scale(T* data, size_t size, T alpha) {
+    for (size_t i = 0; i < size; ++i)
+        data[i] *= alpha;
+}
+
+double sum(const double* data, size_t size);
+double sum(const float* data, size_t size);
+bool minmax(const double* data, size_t size, double& min, double& max);
+bool minmax(const float* data, size_t size, float& min, float& max);
+double dot(const double* x, const double* y, size_t size);
+double dot(const float* x, const float* y, size_t size);
+void axpy(double alpha, const double* x, double* y, size_t size);
+void axpy(float alpha, const float* x, float* y, size_t size);
+void scale(double* data, size_t size, double alpha);
+void scale(float* data, size_t size, float alpha);
+
+} // namespace kernels
+} // namespace effil
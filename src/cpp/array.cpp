@@ -0,0 +1,373 @@
+#include "array.h"
+
+#include "array-kernels.h"
+#include "lua-helpers.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <shared_mutex>
+#include <type_traits>
+
+namespace effil {
+
+namespace {
+
+typedef std::unique_lock<SpinMutex> UniqueLock;
+typedef std::shared_lock<SpinMutex> SharedLock;
+
+struct ElementTypeInfo {
+    const char* name;
+    size_t size;
+};
+
+// order matches ArrayElementType enumeration
+const ElementTypeInfo ELEMENT_TYPES[] = {
+    {"double", sizeof(double)},
+    {"float",  sizeof(float)},
+    {"int64",  sizeof(int64_t)},
+    {"uint8",  sizeof(uint8_t)},
+};
+
+const ElementTypeInfo& elementTypeInfo(ArrayElementType type) {
+    return ELEMENT_TYPES[static_cast<size_t>(type)];
+}
+
+// Calls function with pointer to elements of the actual type
+template <typename Func>
+auto visitElements(ArrayData& data, Func&& func) -> decltype(func(static_cast<double*>(nullptr))) {
+    switch (data.type) {
+        case ArrayElementType::Float: return func(data.elements<float>());
+        case ArrayElementType::Int64: return func(data.elements<int64_t>());
+        case ArrayElementType::UInt8: return func(data.elements<uint8_t>());
+        case ArrayElementType::Double: break;
+    }
+    return func(data.elements<double>());
+}
+
+// Calls function with pointer to elements, array must have floating point elements
+template <typename Func>
+auto visitFloatingElements(ArrayData& data, Func&& func) -> decltype(func(static_cast<double*>(nullptr))) {
+    if (data.type == ArrayElementType::Float)
+        return func(data.elements<float>());
+    return func(data.elements<double>());
+}
+
+// Locks mutexes of two arrays in the address order,
+// so concurrent operations over the same pair of arrays don't deadlock.
+// Only the second lock is taken if both locks refer to the same array.
+template <typename FirstLock, typename SecondLock>
+void lockPair(FirstLock& first, SecondLock& second) {
+    if (first.mutex() == second.mutex()) {
+        second.lock();
+    }
+    else if (std::less<SpinMutex*>()(first.mutex(), second.mutex())) {
+        first.lock();
+        second.lock();
+    }
+    else {
+        second.lock();
+        first.lock();
+    }
+}
+
+sol::object toLua(sol::this_state state, double value) { return sol::make_object(state, static_cast<lua_Number>(value)); }
+sol::object toLua(sol::this_state state, float value) { return sol::make_object(state, static_cast<lua_Number>(value)); }
+sol::object toLua(sol::this_state state, int64_t value) { return sol::make_object(state, static_cast<LUA_INDEX_TYPE>(value)); }
+sol::object toLua(sol::this_state state, uint8_t value) { return sol::make_object(state, static_cast<LUA_INDEX_TYPE>(value)); }
+
+template <typename SolObject>
+lua_Number numberFromLua(const SolObject& value) {
+    REQUIRE(value.get_type() == sol::type::number) << "number expected, got " << luaTypename(value);
+    return value.template as<lua_Number>();
+}
+
+template <typename ElementType, typename SolObject>
+typename std::enable_if<std::is_floating_point<ElementType>::value, ElementType>::type
+fromLua(const SolObject& value) {
+    return static_cast<ElementType>(numberFromLua(value));
+}
+
+template <typename ElementType, typename SolObject>
+typename std::enable_if<std::is_integral<ElementType>::value, ElementType>::type
+fromLua(const SolObject& value) {
+#if LUA_VERSION_NUM == 503
+    if (value.get_type() == sol::type::number) {
+        auto popper = sol::stack::push_pop(value);
+        if (lua_isinteger(value.lua_state(), -1)) {
+            const lua_Integer integer = value.template as<lua_Integer>();
+            REQUIRE(static_cast<lua_Integer>(static_cast<ElementType>(integer)) == integer)
+                    << "value " << integer << " is out of range of element type";
+            return static_cast<ElementType>(integer);
+        }
+    }
+#endif // Lua5.3
+    const lua_Number number = numberFromLua(value);
+    // maximum + 1 is a power of two, so it's represented exactly
+    REQUIRE(std::floor(number) == number &&
+            number >= static_cast<lua_Number>(std::numeric_limits<ElementType>::min()) &&
+            number < static_cast<lua_Number>(std::numeric_limits<ElementType>::max()) + 1)
+            << "value " << number << " is out of range of element type";
+    return static_cast<ElementType>(number);
+}
+
+Array toArray(const sol::stack_object& obj, int argument, const char* function) {
+    REQUIRE(obj.is<Array>())
+            << "bad argument #" << argument << " to 'effil." << function
+            << "' (effil.array expected, got " << luaTypename(obj) << ")";
+    return obj.as<Array>();
+}
+
+lua_Number toNumber(const sol::stack_object& obj, int argument, const char* function) {
+    REQUIRE(obj.get_type() == sol::type::number)
+            << "bad argument #" << argument << " to 'effil." << function
+            << "' (number expected, got " << luaTypename(obj) << ")";
+    return obj.as<lua_Number>();
+}
+
+size_t toSize(const sol::stack_object& obj, int argument, const char* function, size_t minimum) {
+    const lua_Number number = toNumber(obj, argument, function);
+    REQUIRE(std::floor(number) == number && number >= static_cast<lua_Number>(minimum) &&
+            number < static_cast<lua_Number>(std::numeric_limits<size_t>::max()))
+            << "bad argument #" << argument << " to 'effil." << function
+            << "' (integer not less than " << minimum << " expected, got " << number << ")";
+    return static_cast<size_t>(number);
+}
+
+void requireFloating(const ArrayData& data, const char* function) {
+    REQUIRE(data.type == ArrayElementType::Double || data.type == ArrayElementType::Float)
+            << "effil." << function << ": array of floating point elements expected, got effil.array<"
+            << elementTypeInfo(data.type).name << ">";
+}
+
+void requireSameType(const ArrayData& x, const ArrayData& y, const char* function) {
+    REQUIRE(x.type == y.type)
+            << "effil." << function << ": arrays have different element types ("
+            << elementTypeInfo(x.type).name << " and " << elementTypeInfo(y.type).name << ")";
+}
+
+void requireSameSize(const ArrayData& x, const ArrayData& y, const char* function) {
+    REQUIRE(x.size == y.size)
+            << "effil." << function << ": arrays have different sizes (" << x.size << " and " << y.size << ")";
+}
+
+} // namespace
+
+size_t arrayElementSize(ArrayElementType type) {
+    return elementTypeInfo(type).size;
+}
+
+void Array::exportAPI(sol::state_view& lua) {
+    sol::usertype<Array> type("new", sol::no_constructor,
+        sol::meta_function::index,      &Array::luaIndex,
+        sol::meta_function::new_index,  &Array::luaNewIndex,
+        sol::meta_function::length,     &Array::luaLength,
+        sol::meta_function::to_string,  &Array::luaToString
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+void Array::initialize(const sol::stack_object& type, const sol::stack_object& init) {
+    REQUIRE(type.get_type() == sol::type::string)
+            << "bad argument #1 to 'effil.array' (string expected, got "
+            << luaTypename(type) << ")";
+    const std::string typeName = type.as<std::string>();
+    size_t typeIndex = 0;
+    while (typeIndex < sizeof(ELEMENT_TYPES) / sizeof(ELEMENT_TYPES[0]) && typeName != ELEMENT_TYPES[typeIndex].name)
+        ++typeIndex;
+    REQUIRE(typeIndex < sizeof(ELEMENT_TYPES) / sizeof(ELEMENT_TYPES[0]))
+            << "effil.array: unknown element type '" << typeName << "'";
+    const auto& info = ELEMENT_TYPES[typeIndex];
+
+    sol::optional<sol::table> values;
+    size_t size = 0;
+    if (init.get_type() == sol::type::table) {
+        values = init.as<sol::table>();
+        size = values->size();
+    }
+    else {
+        REQUIRE(init.get_type() == sol::type::number)
+                << "bad argument #2 to 'effil.array' (number or table expected, got "
+                << luaTypename(init) << ")";
+        const lua_Number number = init.as<lua_Number>();
+        REQUIRE(std::floor(number) == number && number >= 0 &&
+                number <= static_cast<lua_Number>(std::numeric_limits<size_t>::max() / info.size))
+                << "effil.array: invalid size " << number;
+        size = static_cast<size_t>(number);
+    }
+
+    initialize(static_cast<ArrayElementType>(typeIndex), size);
+
+    if (values) {
+        try {
+            visitElements(*ctx_, [&](auto* elements) {
+                using ElementType = std::remove_pointer_t<decltype(elements)>;
+                for (size_t i = 0; i < size; ++i)
+                    elements[i] = fromLua<ElementType>(values->get<sol::object>(i + 1));
+            });
+        } RETHROW_WITH_PREFIX("effil.array");
+    }
+}
+
+void Array::initialize(ArrayElementType type, size_t size) {
+    ctx_->type = type;
+    ctx_->size = size;
+    ctx_->buffer.reset(new char[size * elementTypeInfo(type).size]());
+}
+
+size_t Array::elementIndex(const sol::stack_object& index) const {
+    REQUIRE(index.get_type() == sol::type::number)
+            << "invalid index type (number expected, got " << luaTypename(index) << ")";
+    const lua_Number number = index.as<lua_Number>();
+    REQUIRE(std::floor(number) == number && number >= 1 && number <= static_cast<lua_Number>(ctx_->size))
+            << "index " << number << " is out of range [1, " << ctx_->size << "]";
+    return static_cast<size_t>(number) - 1;
+}
+
+sol::object Array::luaIndex(const sol::stack_object& index, sol::this_state state) const {
+    try {
+        const size_t i = elementIndex(index);
+        SharedLock lock(ctx_->lock);
+        return visitElements(*ctx_, [&](auto* elements) { return toLua(state, elements[i]); });
+    } RETHROW_WITH_PREFIX("effil.array");
+}
+
+void Array::luaNewIndex(const sol::stack_object& index, const sol::stack_object& value) {
+    try {
+        const size_t i = elementIndex(index);
+        visitElements(*ctx_, [&](auto* elements) {
+            using ElementType = std::remove_pointer_t<decltype(elements)>;
+            const ElementType element = fromLua<ElementType>(value);
+
+            UniqueLock lock(ctx_->lock);
+            elements[i] = element;
+        });
+    } RETHROW_WITH_PREFIX("effil.array");
+}
+
+std::string Array::luaToString() const {
+    std::stringstream ss;
+    ss << "effil.array<" << elementTypeInfo(ctx_->type).name << ">: " << ctx_.get();
+    return ss.str();
+}
+
+sol::object Array::luaDump(sol::this_state state) const {
+    auto result = sol::table::create(state.L, static_cast<int>(ctx_->size), 0);
+    SharedLock lock(ctx_->lock);
+    visitElements(*ctx_, [&](auto* elements) {
+        for (size_t i = 0; i < ctx_->size; ++i)
+            result.set(static_cast<LUA_INDEX_TYPE>(i + 1), toLua(state, elements[i]));
+    });
+    return result;
+}
+
+lua_Number Array::luaSum(const sol::stack_object& obj) {
+    Array array = toArray(obj, 1, "sum");
+    SharedLock lock(array.ctx_->lock);
+    return visitElements(*array.ctx_, [&](auto* elements) {
+        return kernels::sum(elements, array.ctx_->size);
+    });
+}
+
+std::tuple<sol::object, sol::object> Array::luaMinMax(const sol::stack_object& obj, sol::this_state state) {
+    Array array = toArray(obj, 1, "minmax");
+    SharedLock lock(array.ctx_->lock);
+    return visitElements(*array.ctx_, [&](auto* elements) {
+        using ElementType = std::remove_pointer_t<decltype(elements)>;
+        ElementType min = 0;
+        ElementType max = 0;
+        if (!kernels::minmax(elements, array.ctx_->size, min, max))
+            return std::make_tuple(sol::object(sol::nil), sol::object(sol::nil));
+        return std::make_tuple(toLua(state, min), toLua(state, max));
+    });
+}
+
+lua_Number Array::luaDot(const sol::stack_object& xObj, const sol::stack_object& yObj) {
+    Array x = toArray(xObj, 1, "dot");
+    Array y = toArray(yObj, 2, "dot");
+    requireFloating(*x.ctx_, "dot");
+    requireSameType(*x.ctx_, *y.ctx_, "dot");
+    requireSameSize(*x.ctx_, *y.ctx_, "dot");
+
+    SharedLock xLock(x.ctx_->lock, std::defer_lock);
+    SharedLock yLock(y.ctx_->lock, std::defer_lock);
+    lockPair(xLock, yLock);
+    return visitFloatingElements(*x.ctx_, [&](auto* xElements) {
+        using ElementType = std::remove_pointer_t<decltype(xElements)>;
+        return kernels::dot(xElements, y.ctx_->elements<ElementType>(), x.ctx_->size);
+    });
+}
+
+Array Array::luaAxpy(const sol::stack_object& alphaObj, const sol::stack_object& xObj, const sol::stack_object& yObj) {
+    const lua_Number alpha = toNumber(alphaObj, 1, "axpy");
+    Array x = toArray(xObj, 2, "axpy");
+    Array y = toArray(yObj, 3, "axpy");
+    requireFloating(*x.ctx_, "axpy");
+    requireSameType(*x.ctx_, *y.ctx_, "axpy");
+    requireSameSize(*x.ctx_, *y.ctx_, "axpy");
+
+    SharedLock xLock(x.ctx_->lock, std::defer_lock);
+    UniqueLock yLock(y.ctx_->lock, std::defer_lock);
+    lockPair(xLock, yLock);
+    visitFloatingElements(*x.ctx_, [&](auto* xElements) {
+        using ElementType = std::remove_pointer_t<decltype(xElements)>;
+        kernels::axpy(static_cast<ElementType>(alpha), xElements, y.ctx_->elements<ElementType>(), x.ctx_->size);
+    });
+    return y;
+}
+
+Array Array::luaScale(const sol::stack_object& obj, const sol::stack_object& alphaObj) {
+    Array array = toArray(obj, 1, "scale");
+    const lua_Number alpha = toNumber(alphaObj, 2, "scale");
+    requireFloating(*array.ctx_, "scale");
+
+    UniqueLock lock(array.ctx_->lock);
+    visitFloatingElements(*array.ctx_, [&](auto* elements) {
+        using ElementType = std::remove_pointer_t<decltype(elements)>;
+        kernels::scale(elements, array.ctx_->size, static_cast<ElementType>(alpha));
+    });
+    return array;
+}
+
+Array Array::luaFill(const sol::stack_object& obj, const sol::stack_object& value) {
+    Array array = toArray(obj, 1, "fill");
+    try {
+        visitElements(*array.ctx_, [&](auto* elements) {
+            using ElementType = std::remove_pointer_t<decltype(elements)>;
+            const ElementType element = fromLua<ElementType>(value);
+
+            UniqueLock lock(array.ctx_->lock);
+            std::fill_n(elements, array.ctx_->size, element);
+        });
+    } RETHROW_WITH_PREFIX("effil.fill");
+    return array;
+}
+
+Array Array::luaCopyRange(const sol::stack_object& destinationObj, const sol::stack_object& destinationIndex,
+                          const sol::stack_object& sourceObj, const sol::stack_object& sourceIndex,
+                          const sol::stack_object& countObj) {
+    Array destination = toArray(destinationObj, 1, "copy_range");
+    const size_t destinationStart = toSize(destinationIndex, 2, "copy_range", 1) - 1;
+    Array source = toArray(sourceObj, 3, "copy_range");
+    const size_t sourceStart = toSize(sourceIndex, 4, "copy_range", 1) - 1;
+    const size_t count = toSize(countObj, 5, "copy_range", 0);
+    requireSameType(*destination.ctx_, *source.ctx_, "copy_range");
+    REQUIRE(count <= destination.ctx_->size && destinationStart <= destination.ctx_->size - count &&
+            count <= source.ctx_->size && sourceStart <= source.ctx_->size - count)
+            << "effil.copy_range: range is out of bounds";
+
+    SharedLock sourceLock(source.ctx_->lock, std::defer_lock);
+    UniqueLock destinationLock(destination.ctx_->lock, std::defer_lock);
+    lockPair(sourceLock, destinationLock);
+    const size_t elementSize = elementTypeInfo(destination.ctx_->type).size;
+    // ranges may overlap if both arrays are the same
+    std::memmove(destination.ctx_->buffer.get() + destinationStart * elementSize,
+                 source.ctx_->buffer.get() + sourceStart * elementSize,
+                 count * elementSize);
+    return destination;
+}
+
+} // namespace effil
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "gc-data.h"
+#include "gc-object.h"
+#include "spin-mutex.h"
+#include "utils.h"
+
+#include <sol.hpp>
+
+#include <memory>
+#include <tuple>
+
+namespace effil {
+
+enum class ArrayElementType {
+    Double,
+    Float,
+    Int64,
+    UInt8
+};
+
+size_t arrayElementSize(ArrayElementType type);
+
+// Fixed size array of numbers stored in a flat buffer
+class ArrayData : public GCData {
+public:
+    template <typename ElementType>
+    ElementType* elements() { return reinterpret_cast<ElementType*>(buffer.get()); }
+
+    size_t memory() const override {
+        return sizeof(ArrayData) + size * arrayElementSize(type) + referencesMemory();
+    }
+
+public:
+    SpinMutex lock; // guards elements
+    ArrayElementType type = ArrayElementType::Double;
+    size_t size = 0;
+    std::unique_ptr<char[]> buffer;
+};
+
+class Array : public GCObject<ArrayData, GCObjectType::Array> {
+public:
+    static void exportAPI(sol::state_view& lua);
+
+    size_t size() const { return ctx_->size; }
+    sol::object luaDump(sol::this_state state) const;
+
+    // These functions are metamethods available in Lua
+    sol::object luaIndex(const sol::stack_object& index, sol::this_state state) const;
+    void luaNewIndex(const sol::stack_object& index, const sol::stack_object& value);
+    size_t luaLength() const { return size(); }
+    std::string luaToString() const;
+
+    // Vectorized operations available as effil.sum, effil.dot, etc.
+    static lua_Number luaSum(const sol::stack_object& array);
+    static std::tuple<sol::object, sol::object> luaMinMax(const sol::stack_object& array, sol::this_state state);
+    static lua_Number luaDot(const sol::stack_object& x, const sol::stack_object& y);
+    static Array luaAxpy(const sol::stack_object& alpha, const sol::stack_object& x, const sol::stack_object& y);
+    static Array luaScale(const sol::stack_object& array, const sol::stack_object& alpha);
+    static Array luaFill(const sol::stack_object& array, const sol::stack_object& value);
+    static Array luaCopyRange(const sol::stack_object& destination, const sol::stack_object& destinationIndex,
+                              const sol::stack_object& source, const sol::stack_object& sourceIndex,
+                              const sol::stack_object& count);
+
+private:
+    size_t elementIndex(const sol::stack_object& index) const;
+
+private:
+    Array() = default;
+    void initialize(const sol::stack_object& type, const sol::stack_object& init);
+    // Zero filled array
+    void initialize(ArrayElementType type, size_t size);
+    friend class GC;
+    friend class SnapshotWriter;
+    friend class SnapshotReader;
+};
+
+} // namespace effil
@@ -0,0 +1,179 @@
+#include "cache.h"
+
+#include "sol.hpp"
+
+#include <mutex>
+
+namespace effil {
+
+namespace {
+
+typedef std::lock_guard<SpinMutex> LockGuard;
+
+CacheData::Entry& entryOf(const StoredObject& indexValue) {
+    return *static_cast<CacheData::Entry*>(indexValue.toPointer());
+}
+
+} // namespace
+
+size_t CacheData::memory() const {
+    size_t total = sizeof(CacheData) + referencesMemory();
+    LockGuard g(lock);
+    // list nodes contain two pointers besides the element
+    total += index.memory()
+            + recency.size() * (sizeof(Entry) + 3 * sizeof(void*))
+            + expiration.size() * 3 * sizeof(void*);
+    // keys are accounted by the index
+    for (const auto& entry : recency)
+        total += entry->value.memory();
+    return total;
+}
+
+void Cache::exportAPI(sol::state_view& lua) {
+    sol::usertype<Cache> type("new", sol::no_constructor,
+        "get",    &Cache::get,
+        "put",    &Cache::put,
+        "remove", &Cache::remove,
+        "clear",  &Cache::clear,
+        "size",   &Cache::size
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+void Cache::initialize(const sol::stack_object& options) {
+    if (!options.valid())
+        return;
+
+    REQUIRE(options.get_type() == sol::type::table)
+            << "bad argument #1 to 'effil.cache' (table expected, got "
+            << luaTypename(options) << ")";
+    const sol::table luaOptions = options.as<sol::table>();
+
+    const sol::object capacity = luaOptions["capacity"];
+    if (capacity.valid()) {
+        REQUIRE(capacity.get_type() == sol::type::number)
+                << "effil.cache: invalid capacity type (number expected, got "
+                << luaTypename(capacity) << ")";
+        REQUIRE(capacity.as<lua_Number>() >= 0)
+                << "effil.cache: invalid capacity value = " << capacity.as<lua_Number>();
+        ctx_->capacity = capacity.as<size_t>();
+    }
+
+    const sol::object ttl = luaOptions["ttl"];
+    if (ttl.valid()) {
+        REQUIRE(ttl.get_type() == sol::type::number)
+                << "effil.cache: invalid ttl type (number expected, got "
+                << luaTypename(ttl) << ")";
+        REQUIRE(ttl.as<lua_Number>() >= 0)
+                << "effil.cache: invalid ttl value = " << ttl.as<lua_Number>();
+        ctx_->ttl = std::chrono::milliseconds(static_cast<std::chrono::milliseconds::rep>(ttl.as<lua_Number>()));
+    }
+}
+
+sol::object Cache::get(const sol::stack_object& luaKey, sol::this_state state) {
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        return withStoredKeyView(luaKey, [&](const StoredKeyView& key) -> sol::object {
+            LockGuard g(ctx_->lock);
+            removeExpired(CacheData::Clock::now());
+            const StoredObject* found = ctx_->index.find(key);
+            if (found == nullptr)
+                return sol::nil;
+
+            auto& entry = entryOf(*found);
+            ctx_->recency.splice(ctx_->recency.begin(), ctx_->recency, entry.recency);
+            return entry.value.unpack(state);
+        });
+    } RETHROW_WITH_PREFIX("effil.cache:get");
+}
+
+void Cache::put(const sol::stack_object& luaKey, const sol::stack_object& luaValue) {
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        if (!luaValue.valid()) {
+            remove(luaKey);
+            return;
+        }
+
+        StoredObject key = createStoredObject(luaKey);
+        StoredObject value = createStoredObject(luaValue);
+        const auto now = CacheData::Clock::now();
+
+        LockGuard g(ctx_->lock);
+        removeExpired(now);
+        ctx_->addReference(value.gcHandle());
+        value.releaseStrongReference();
+
+        CacheData::Entry* entry = nullptr;
+        if (const StoredObject* found = ctx_->index.find(key)) {
+            entry = &entryOf(*found);
+            ctx_->removeReference(entry->value.gcHandle());
+            entry->value = std::move(value);
+            ctx_->recency.splice(ctx_->recency.begin(), ctx_->recency, entry->recency);
+            if (ctx_->ttl.count() != 0)
+                ctx_->expiration.splice(ctx_->expiration.end(), ctx_->expiration, entry->expiration);
+        }
+        else {
+            ctx_->addReference(key.gcHandle());
+            key.releaseStrongReference();
+
+            std::unique_ptr<CacheData::Entry> created(new CacheData::Entry());
+            created->key = key;
+            created->value = std::move(value);
+            entry = created.get();
+            ctx_->recency.push_front(std::move(created));
+            entry->recency = ctx_->recency.begin();
+            if (ctx_->ttl.count() != 0)
+                entry->expiration = ctx_->expiration.insert(ctx_->expiration.end(), entry);
+            ctx_->index.set(std::move(key), StoredObject::lightUserdata(entry));
+
+            if (ctx_->capacity != 0 && ctx_->recency.size() > ctx_->capacity)
+                removeEntry(*ctx_->recency.back());
+        }
+        entry->expires = now + ctx_->ttl;
+    } RETHROW_WITH_PREFIX("effil.cache:put");
+}
+
+void Cache::remove(const sol::stack_object& luaKey) {
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        withStoredKeyView(luaKey, [&](const StoredKeyView& key) {
+            LockGuard g(ctx_->lock);
+            if (const StoredObject* found = ctx_->index.find(key))
+                removeEntry(entryOf(*found));
+        });
+    } RETHROW_WITH_PREFIX("effil.cache:remove");
+}
+
+void Cache::clear() {
+    LockGuard g(ctx_->lock);
+    while (!ctx_->recency.empty())
+        removeEntry(*ctx_->recency.back());
+    ctx_->index.compact();
+}
+
+size_t Cache::size() {
+    LockGuard g(ctx_->lock);
+    removeExpired(CacheData::Clock::now());
+    return ctx_->recency.size();
+}
+
+void Cache::removeExpired(CacheData::Clock::time_point now) {
+    if (ctx_->ttl.count() == 0)
+        return;
+    while (!ctx_->expiration.empty() && ctx_->expiration.front()->expires <= now)
+        removeEntry(*ctx_->expiration.front());
+}
+
+void Cache::removeEntry(CacheData::Entry& entry) {
+    ctx_->index.erase(entry.key);
+    ctx_->removeReference(entry.key.gcHandle());
+    ctx_->removeReference(entry.value.gcHandle());
+    if (ctx_->ttl.count() != 0)
+        ctx_->expiration.erase(entry.expiration);
+    // destroys the entry
+    ctx_->recency.erase(entry.recency);
+}
+
+} // namespace effil
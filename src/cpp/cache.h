@@ -0,0 +1,66 @@
+#pragma once
+
+#include "gc-data.h"
+#include "gc-object.h"
+#include "table-storage.h"
+#include "spin-mutex.h"
+#include "lua-helpers.h"
+
+#include <sol.hpp>
+
+#include <chrono>
+#include <list>
+#include <memory>
+
+namespace effil {
+
+class CacheData : public GCData {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        StoredObject key;
+        StoredObject value;
+        Clock::time_point expires;
+        std::list<std::unique_ptr<Entry>>::iterator recency;
+        std::list<Entry*>::iterator expiration;
+    };
+
+    size_t memory() const override;
+
+public:
+    mutable SpinMutex lock; // guards entries
+    size_t capacity = 0; // 0 means unlimited
+    std::chrono::milliseconds ttl {0}; // 0 means that entries never expire
+    // Maps keys to light userdata pointing to entries
+    TableStorage index;
+    // The most recently used entries go first
+    std::list<std::unique_ptr<Entry>> recency;
+    // TTL is the same for all entries, so the order of expiration is the order of puts
+    std::list<Entry*> expiration;
+};
+
+// Key-value cache with LRU eviction and expiration of entries.
+// All operations take constant time.
+class Cache : public GCObject<CacheData, GCObjectType::Cache> {
+public:
+    static void exportAPI(sol::state_view& lua);
+
+    sol::object get(const sol::stack_object& key, sol::this_state state);
+    void put(const sol::stack_object& key, const sol::stack_object& value);
+    void remove(const sol::stack_object& key);
+    void clear();
+    size_t size();
+
+private:
+    // Cache should be locked
+    void removeExpired(CacheData::Clock::time_point now);
+    void removeEntry(CacheData::Entry& entry);
+
+private:
+    Cache() = default;
+    void initialize(const sol::stack_object& options);
+    friend class GC;
+};
+
+} // namespace effil
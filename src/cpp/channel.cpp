@@ -4,6 +4,17 @@
 
 namespace effil {
 
+size_t ChannelData::memory() const {
+    size_t total = sizeof(ChannelData) + referencesMemory();
+    std::lock_guard<std::mutex> lock(lock_);
+    for (const auto& message : channel_) {
+        total += sizeof(StoredArray) + message.capacity() * sizeof(StoredObject);
+        for (const auto& value : message)
+            total += value.memory();
+    }
+    return total;
+}
+
 void Channel::exportAPI(sol::state_view& lua) {
     sol::usertype<Channel> type("new", sol::no_constructor,
         "push",  &Channel::push,
@@ -39,13 +50,13 @@ bool Channel::push(const sol::variadic_args& args) {
     for (const auto& arg : args) {
         try {
             auto obj = createStoredObject(arg.get<sol::object>());
-            ctx_->addReference(obj->gcHandle());
-            obj->releaseStrongReference();
+            ctx_->addReference(obj.gcHandle());
+            obj.releaseStrongReference();
             array.emplace_back(obj);
         }
         RETHROW_WITH_PREFIX("effil.channel:push");
     }
-    ctx_->channel_.emplace(array);
+    ctx_->channel_.emplace_back(array);
     ctx_->cv_.notify_one();
     return true;
 }
@@ -75,12 +86,12 @@ StoredArray Channel::pop(const sol::optional<int>& duration,
     }
 
     auto ret = ctx_->channel_.front();
-    for (const auto& obj: ret) {
-        obj->holdStrongReference();
-        ctx_->removeReference(obj->gcHandle());
+    for (auto& obj: ret) {
+        obj.holdStrongReference();
+        ctx_->removeReference(obj.gcHandle());
     }
 
-    ctx_->channel_.pop();
+    ctx_->channel_.pop_front();
     return ret;
 }
 
@@ -5,19 +5,21 @@
 #include "gc-data.h"
 #include "gc-object.h"
 
-#include <queue>
+#include <deque>
 
 namespace effil {
 
 class ChannelData : public GCData {
 public:
-    std::mutex lock_;
+    size_t memory() const override;
+
+    mutable std::mutex lock_;
     std::condition_variable cv_;
     size_t capacity_;
-    std::queue<StoredArray> channel_;
+    std::deque<StoredArray, SlabAllocator<StoredArray>> channel_;
 };
 
-class Channel : public GCObject<ChannelData>, public IInterruptable {
+class Channel : public GCObject<ChannelData, GCObjectType::Channel>, public IInterruptable {
 public:
     static void exportAPI(sol::state_view& lua);
 
@@ -0,0 +1,36 @@
+#include "file-replacement.h"
+
+#include "utils.h"
+
+#include <cstdio>
+
+namespace effil {
+
+FileReplacement::FileReplacement(const std::string& path)
+        : path_(path), temporary_(path + ".tmp"), file_(temporary_, std::ios::binary | std::ios::trunc) {
+    REQUIRE(file_.is_open()) << "unable to open '" << temporary_ << "' for writing";
+}
+
+FileReplacement::~FileReplacement() {
+    if (!committed_) {
+        file_.close();
+        std::remove(temporary_.c_str());
+    }
+}
+
+void FileReplacement::write(const char* data, size_t size) {
+    file_.write(data, static_cast<std::streamsize>(size));
+    REQUIRE(file_.good()) << "unable to write '" << temporary_ << "'";
+}
+
+void FileReplacement::commit() {
+    file_.close();
+    REQUIRE(file_.good()) << "unable to write '" << temporary_ << "'";
+#ifdef _WIN32
+    std::remove(path_.c_str());
+#endif // _WIN32
+    REQUIRE(std::rename(temporary_.c_str(), path_.c_str()) == 0) << "unable to replace '" << path_ << "'";
+    committed_ = true;
+}
+
+} // namespace effil
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+
+namespace effil {
+
+// Writes new contents of the file next to it and replaces the file at once on commit.
+// Readers never see incomplete contents and failed writes keep the previous file.
+// Temporary file is removed if the replacement isn't committed.
+class FileReplacement {
+public:
+    explicit FileReplacement(const std::string& path);
+    ~FileReplacement();
+
+    FileReplacement(const FileReplacement&) = delete;
+    FileReplacement& operator=(const FileReplacement&) = delete;
+
+    void write(const char* data, size_t size);
+    void commit();
+
+private:
+    std::string path_;
+    std::string temporary_;
+    std::ofstream file_;
+    bool committed_ = false;
+};
+
+} // namespace effil
@@ -45,16 +45,16 @@ void Function::initialize(const sol::function& luaObject, SolTableToShared& visi
         try {
             const auto& upvalue = sol::stack::pop<sol::object>(state);
             storedObject = createStoredObject(upvalue, visited);
-            assert(storedObject.get() != nullptr);
+            assert(storedObject);
         }
         catch(const std::exception& err) {
             sol::stack::pop<sol::object>(state);
             throw effil::Exception() << "bad function upvalue #" << (int)i << " (" << err.what() << ")";
         }
 
-        if (storedObject->gcHandle() != nullptr) {
-            ctx_->addReference(storedObject->gcHandle());
-            storedObject->releaseStrongReference();
+        if (storedObject.gcHandle() != nullptr) {
+            ctx_->addReference(storedObject.gcHandle());
+            storedObject.releaseStrongReference();
         }
         ctx_->upvalues[i - 1] = std::move(storedObject);
     }
@@ -75,7 +75,7 @@ sol::object Function::convert(lua_State* state, const Converter& clbk) const
             continue;
         }
 #endif // LUA_VERSION_NUM > 501
-        assert(ctx_->upvalues[i].get() != nullptr);
+        assert(ctx_->upvalues[i]);
 
         sol::stack::push(state, clbk(ctx_->upvalues[i]));
         lua_setupvalue(state, -2, i + 1);
@@ -83,15 +83,24 @@ sol::object Function::convert(lua_State* state, const Converter& clbk) const
     return sol::stack::pop<sol::function>(state);
 }
 
+size_t FunctionData::memory() const {
+    // function is immutable after creation, so no locks are needed
+    size_t total = sizeof(FunctionData) + function.capacity()
+            + upvalues.capacity() * sizeof(StoredObject) + referencesMemory();
+    for (const auto& upvalue : upvalues)
+        total += upvalue.memory();
+    return total;
+}
+
 sol::object Function::loadFunction(lua_State* state) const {
     return convert(state, [&](const StoredObject& obj){
-        return obj->unpack(sol::this_state{state});
+        return obj.unpack(sol::this_state{state});
     });
 }
 
 sol::object Function::convertToLua(lua_State* state, BaseHolder::DumpCache& cache) const {
     return convert(state, [&](const StoredObject& obj) {
-        return obj->convertToLua(sol::this_state{state}, cache);
+        return obj.convertToLua(sol::this_state{state}, cache);
     });
 }
 
@@ -9,14 +9,16 @@ namespace effil {
 
 class FunctionData : public GCData {
 public:
+    size_t memory() const override;
+
     std::string function;
 #if LUA_VERSION_NUM > 501
     unsigned char envUpvaluePos;
 #endif // LUA_VERSION_NUM > 501
-    std::vector<StoredObject> upvalues;
+    StoredArray upvalues;
 };
 
-class Function : public GCObject<FunctionData> {
+class Function : public GCObject<FunctionData, GCObjectType::Function> {
 public:
     sol::object loadFunction(lua_State* state) const;
     sol::object convertToLua(lua_State* state, BaseHolder::DumpCache& cache) const;
@@ -26,9 +28,12 @@ private:
     sol::object convert(lua_State* state, const Converter& clbk) const;
 
     Function() = default;
+    void initialize() {}
     void initialize(const sol::function& luaObject, SolTableToShared& visited);
     void initialize(const sol::function& luaObject);
     friend class GC;
+    friend class SnapshotWriter;
+    friend class SnapshotReader;
 };
 
 } // namespace effil
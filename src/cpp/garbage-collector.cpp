@@ -1,4 +1,5 @@
 #include "garbage-collector.h"
+#include "gc-data.h"
 
 #include "utils.h"
 #include "lua-helpers.h"
@@ -52,6 +53,30 @@ size_t GC::count() const {
     return objects_.size();
 }
 
+std::shared_ptr<GCData> GC::data(GCHandle handle) {
+    std::lock_guard<std::mutex> g(lock_);
+    auto it = objects_.find(handle);
+    REQUIRE(it != objects_.end()) << "unknown effil object handle";
+    return it->second->data();
+}
+
+size_t GC::memory() const {
+    // Objects are measured out of the GC lock:
+    // measuring locks the objects, and they may be locked while the GC lock is taken
+    std::vector<std::shared_ptr<GCData>> objects;
+    {
+        std::lock_guard<std::mutex> g(lock_);
+        objects.reserve(objects_.size());
+        for (const auto& handleAndObject : objects_)
+            objects.push_back(handleAndObject.second->data());
+    }
+
+    size_t total = 0;
+    for (const auto& object : objects)
+        total += object->memory();
+    return total;
+}
+
 GC& GC::instance() {
     static GC gc;
     return gc;
@@ -79,6 +104,9 @@ sol::table GC::exportAPI(sol::state_view& lua) {
     api["count"] = [] {
         return instance().count();
     };
+    api["memory"] = [] {
+        return instance().memory();
+    };
     return api;
 }
 
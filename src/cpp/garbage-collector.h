@@ -39,11 +39,15 @@ public:
         auto it = objects_.find(handle);
         assert(it != objects_.end());
 
-        auto result = dynamic_cast<ObjectType*>(it->second.get());
-        assert(result);
-        return *result;
+        BaseGCObject* object = it->second.get();
+        assert(object->type() == ObjectType::TYPE);
+        return *static_cast<ObjectType*>(object);
     }
 
+    // Shared data of the object of any type.
+    // Object isn't collected while the returned pointer is alive.
+    std::shared_ptr<GCData> data(GCHandle handle);
+
 private:
     mutable std::mutex lock_;
     bool enabled_;
@@ -63,6 +67,7 @@ private:
     void step(double newStep) { step_ = newStep; }
     bool enabled() { return enabled_; }
     size_t count() const;
+    size_t memory() const;
 };
 
 } // effil
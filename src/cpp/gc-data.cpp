@@ -28,4 +28,10 @@ void GCData::removeReference(GCHandle handle) {
     weakRefs_.erase(hit);
 }
 
+size_t GCData::referencesMemory() const {
+    std::lock_guard<SpinMutex> lock(mutex_);
+    // nodes of the hash set contain the next pointer and the cached hash
+    return weakRefs_.size() * (sizeof(GCHandle) + 2 * sizeof(void*)) + weakRefs_.bucket_count() * sizeof(void*);
+}
+
 } // namespace effil
\ No newline at end of file
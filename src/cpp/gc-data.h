@@ -3,13 +3,14 @@
 #include "spin-mutex.h"
 #include "gc-object.h"
 
+#include <memory>
 #include <unordered_set>
 
 namespace effil {
 
 // Base class for data represented in Lua.
 // Derived classes always managed by corresponding views.
-class GCData {
+class GCData : public std::enable_shared_from_this<GCData> {
 public:
     GCData() = default;
     virtual ~GCData() = default;
@@ -19,6 +20,13 @@ public:
     void addReference(GCHandle handle);
     void removeReference(GCHandle handle);
 
+    // Approximate number of bytes held by the object.
+    // Nested effil objects aren't included, they are accounted on their own.
+    virtual size_t memory() const { return sizeof(GCData) + referencesMemory(); }
+
+protected:
+    size_t referencesMemory() const;
+
 public:
     GCData(const GCData&) = delete;
     GCData& operator=(const GCData&) = delete;
@@ -2,6 +2,7 @@
 
 #include <unordered_set>
 #include <memory>
+#include <cstdint>
 
 namespace effil {
 
@@ -11,20 +12,43 @@ using GCHandle = void*;
 // Mock handle for non gc objects
 static const GCHandle GCNull = nullptr;
 
+class GCData;
+
+// Type tag of GC objects, allows to check type without RTTI
+enum class GCObjectType : uint8_t {
+    SharedTable,
+    Channel,
+    Array,
+    Function,
+    Thread,
+    ThreadRunner,
+    Cache
+};
+
 // GCObject interface represents beheiviour of object.
 // Multiple views may hold shred instance of Impl.
 class BaseGCObject {
 public:
+    explicit BaseGCObject(GCObjectType type) : type_(type) {}
     virtual ~BaseGCObject() = default;
     virtual GCHandle handle() const = 0;
     virtual size_t instances() const = 0;
     virtual std::unordered_set<GCHandle> refers() const = 0;
+    // Shared data of the view
+    virtual std::shared_ptr<GCData> data() const = 0;
+
+    GCObjectType type() const { return type_; }
+
+private:
+    GCObjectType type_;
 };
 
-template<typename Impl>
+template<typename Impl, GCObjectType Type>
 class GCObject : public BaseGCObject {
 public:
-    GCObject() : ctx_(std::make_shared<Impl>())
+    static constexpr GCObjectType TYPE = Type;
+
+    GCObject() : BaseGCObject(Type), ctx_(std::make_shared<Impl>())
     {}
 
     // All views are copy constructable
@@ -47,8 +71,22 @@ public:
         return ctx_->refers();
     }
 
+    std::shared_ptr<GCData> data() const final {
+        return ctx_;
+    }
+
+    size_t memory() const {
+        return ctx_->memory();
+    }
+
 protected:
+    // View of existing data
+    explicit GCObject(std::shared_ptr<Impl> ctx) : BaseGCObject(Type), ctx_(std::move(ctx)) {}
+
     std::shared_ptr<Impl> ctx_;
 };
 
+template<typename Impl, GCObjectType Type>
+constexpr GCObjectType GCObject<Impl, Type>::TYPE;
+
 } // namespace effil
@@ -9,6 +9,9 @@ namespace effil {
 class SharedTable;
 class Channel;
 class Thread;
+class Array;
+class MappedTable;
+class Cache;
 
 std::string dumpFunction(const sol::function& f);
 sol::function loadString(const sol::state_view& lua, const std::string& str,
@@ -24,6 +27,12 @@ std::string luaTypename(const SolObject& obj) {
             return "effil.channel";
         else if (obj.template is<Thread>())
             return "effil.thread";
+        else if (obj.template is<Array>())
+            return "effil.array";
+        else if (obj.template is<MappedTable>())
+            return "effil.mmap_table";
+        else if (obj.template is<Cache>())
+            return "effil.cache";
         else
             return "userdata";
     }
@@ -32,7 +41,7 @@ std::string luaTypename(const SolObject& obj) {
     }
 }
 
-typedef std::vector<effil::StoredObject> StoredArray;
+typedef std::vector<effil::StoredObject, SlabAllocator<effil::StoredObject>> StoredArray;
 
 class Timer {
 public:
@@ -54,7 +63,7 @@ namespace stack {
         int push(lua_State* state, const effil::StoredArray& args) {
             int p = 0;
             for (const auto& i : args) {
-                p += stack::push(state, i->unpack(sol::this_state{state}));
+                p += stack::push(state, i.unpack(sol::this_state{state}));
             }
             return p;
         }
@@ -3,6 +3,10 @@
 #include "garbage-collector.h"
 #include "channel.h"
 #include "thread_runner.h"
+#include "array.h"
+#include "snapshot.h"
+#include "mapped-table.h"
+#include "cache.h"
 
 #include <lua.hpp>
 
@@ -10,20 +14,66 @@ using namespace effil;
 
 namespace {
 
-sol::object createTable(sol::this_state lua, const sol::optional<sol::object>& tbl) {
-    if (tbl)
+sol::object createTable(sol::this_state lua, const sol::stack_object& tbl, const sol::stack_object& options) {
+    if (tbl.valid())
     {
-        REQUIRE(tbl->get_type() == sol::type::table) << "Unexpected type for effil.table, table expected got: "
-                                                     << lua_typename(lua, (int)tbl->get_type());
-        return createStoredObject(*tbl)->unpack(lua);
+        REQUIRE(tbl.get_type() == sol::type::table) << "Unexpected type for effil.table, table expected got: "
+                                                    << lua_typename(lua, (int)tbl.get_type());
     }
-    return sol::make_object(lua, GC::instance().create<SharedTable>());
+
+    size_t shards = 1;
+    if (options.valid()) {
+        REQUIRE(options.get_type() == sol::type::table)
+                << "bad argument #2 to 'effil.table' (table expected, got "
+                << luaTypename(options) << ")";
+        const sol::object luaShards = options.as<sol::table>()["shards"];
+        if (luaShards.valid()) {
+            REQUIRE(luaShards.get_type() == sol::type::number)
+                    << "effil.table: invalid shards type (number expected, got "
+                    << luaTypename(luaShards) << ")";
+            REQUIRE(luaShards.as<int>() >= 1 && luaShards.as<size_t>() <= MAXIMUM_TABLE_SHARDS)
+                    << "effil.table: invalid shards value = " << luaShards.as<int>();
+            shards = luaShards.as<size_t>();
+        }
+    }
+
+    if (shards == 1) {
+        if (tbl.valid())
+            return createStoredObject(tbl).unpack(lua);
+        return sol::make_object(lua, GC::instance().create<SharedTable>());
+    }
+
+    SharedTable table = GC::instance().create<SharedTable>(shards);
+    if (tbl.valid()) {
+        SolTableToShared visited;
+        copyLuaTable(table, tbl.as<sol::table>(), visited);
+    }
+    return sol::make_object(lua, table);
 }
 
 sol::object createChannel(const sol::stack_object& capacity, sol::this_state lua) {
     return sol::make_object(lua, GC::instance().create<Channel>(capacity));
 }
 
+sol::object createCache(const sol::stack_object& options, sol::this_state lua) {
+    return sol::make_object(lua, GC::instance().create<Cache>(options));
+}
+
+sol::object createArray(const sol::stack_object& type, const sol::stack_object& init, sol::this_state lua) {
+    return sol::make_object(lua, GC::instance().create<Array>(type, init));
+}
+
+sol::table allocatorStats(sol::this_state lua) {
+    const SlabStats stats = slabStats();
+    sol::table result = sol::state_view(lua).create_table();
+    result["allocations"] = stats.allocations;
+    result["hits"] = stats.hits;
+    result["refills"] = stats.refills;
+    result["slabs"] = stats.slabs;
+    result["large"] = stats.large;
+    return result;
+}
+
 SharedTable globalTable = GC::instance().create<SharedTable>();
 
 std::string getLuaTypename(const sol::stack_object& obj) {
@@ -35,16 +85,46 @@ size_t luaSize(const sol::stack_object& obj) {
         return SharedTable::luaSize(obj);
     else if (obj.is<Channel>())
         return obj.as<Channel>().size();
+    else if (obj.is<Array>())
+        return obj.as<Array>().size();
+    else if (obj.is<MappedTable>())
+        return obj.as<MappedTable>().size();
+    else if (obj.is<Cache>())
+        return obj.as<Cache>().size();
 
     throw effil::Exception() << "Unsupported type "
                              << luaTypename(obj) << " for effil.size()";
 }
 
+size_t luaMemory(const sol::stack_object& obj) {
+    if (obj.is<SharedTable>())
+        return obj.as<SharedTable>().memory();
+    else if (obj.is<Channel>())
+        return obj.as<Channel>().memory();
+    else if (obj.is<Array>())
+        return obj.as<Array>().memory();
+    else if (obj.is<Thread>())
+        return obj.as<Thread>().memory();
+    else if (obj.is<Cache>())
+        return obj.as<Cache>().memory();
+
+    throw effil::Exception() << "bad argument #1 to 'effil.memory' (effil object expected, got "
+                             << luaTypename(obj) << ")";
+}
+
 sol::object luaDump(sol::this_state lua, const sol::stack_object& obj) {
     if (obj.is<SharedTable>()) {
         BaseHolder::DumpCache cache;
+        // Dumped tables are referenced from the registry until the end of dump
+        ScopeGuard releaseReferences([&] {
+            for (const auto& entry : cache)
+                luaL_unref(lua, LUA_REGISTRYINDEX, entry.second);
+        });
         return obj.as<SharedTable>().luaDump(lua, cache);
     }
+    else if (obj.is<Array>()) {
+        return obj.as<Array>().luaDump(lua);
+    }
     else if (obj.get_type() == sol::type::table) {
         return obj;
     }
@@ -53,6 +133,43 @@ sol::object luaDump(sol::this_state lua, const sol::stack_object& obj) {
                              << luaTypename(obj) << ")";
 }
 
+sol::object createMappedTable(sol::this_state lua, const sol::stack_object& path, const sol::stack_object& source) {
+    REQUIRE(path.valid() && path.get_type() == sol::type::string)
+            << "bad argument #1 to 'effil.mmap_table' (string expected, got " << luaTypename(path) << ")";
+    const bool create = source.valid() && source.get_type() != sol::type::nil;
+    REQUIRE(!create || source.get_type() == sol::type::table || source.is<SharedTable>())
+            << "bad argument #2 to 'effil.mmap_table' (table expected, got " << luaTypename(source) << ")";
+    try {
+        if (!create)
+            return sol::make_object(lua, MappedTable::open(path.as<std::string>()));
+
+        // Shared tables are dumped first, dump keeps shared subtables and cycles
+        const sol::table luaTable = source.get_type() == sol::type::table
+                ? source.as<sol::table>()
+                : luaDump(lua, source).as<sol::table>();
+        return sol::make_object(lua, MappedTable::create(path.as<std::string>(), luaTable));
+    } RETHROW_WITH_PREFIX("effil.mmap_table");
+}
+
+// Iteration functions accept both shared and mapped tables
+MappedTable::PairsIterator luaPairs(sol::this_state lua, const sol::stack_object& obj) {
+    if (obj.is<MappedTable>())
+        return obj.as<MappedTable>().luaPairs(lua);
+    return SharedTable::globalLuaPairs(lua, obj);
+}
+
+MappedTable::PairsIterator luaIPairs(sol::this_state lua, const sol::stack_object& obj) {
+    if (obj.is<MappedTable>())
+        return obj.as<MappedTable>().luaIPairs(lua);
+    return SharedTable::globalLuaIPairs(lua, obj);
+}
+
+MappedTable::PairsIterator luaNext(sol::this_state lua, const sol::stack_object& obj, const sol::stack_object& key) {
+    if (obj.is<MappedTable>())
+        return obj.as<MappedTable>().next(key, lua);
+    return SharedTable::globalLuaNext(lua, obj, key);
+}
+
 sol::table createThreadRunner(sol::this_state state, const sol::stack_object& obj) {
     REQUIRE(obj.valid() && obj.get_type() == sol::type::function)
             << "bad argument #1 to 'effil.thread' (function expected, got "
@@ -78,6 +195,9 @@ int luaopen_effil(lua_State* L) {
     Thread::exportAPI(lua);
     SharedTable::exportAPI(lua);
     Channel::exportAPI(lua);
+    Array::exportAPI(lua);
+    MappedTable::exportAPI(lua);
+    Cache::exportAPI(lua);
     ThreadRunner::exportAPI(lua);
 
     const sol::table  gcApi     = GC::exportAPI(lua);
@@ -103,16 +223,40 @@ int luaopen_effil(lua_State* L) {
         "table",        createTable,
         "rawset",       SharedTable::luaRawSet,
         "rawget",       SharedTable::luaRawGet,
+        "set_many",     SharedTable::luaSetMany,
+        "get_many",     SharedTable::luaGetMany,
+        "update",       SharedTable::luaUpdate,
+        "atomic_add",   SharedTable::luaAtomicAdd,
+        "compare_and_swap", SharedTable::luaCompareAndSwap,
+        "exchange",     SharedTable::luaExchange,
+        "freeze",       SharedTable::luaFreeze,
+        "is_frozen",    SharedTable::luaIsFrozen,
+        "wait",         SharedTable::luaWait,
         "setmetatable", SharedTable::luaSetMetatable,
         "getmetatable", SharedTable::luaGetMetatable,
         "channel",      createChannel,
+        "array",        createArray,
+        "mmap_table",   createMappedTable,
+        "cache",        createCache,
+        "sum",          Array::luaSum,
+        "minmax",       Array::luaMinMax,
+        "dot",          Array::luaDot,
+        "axpy",         Array::luaAxpy,
+        "scale",        Array::luaScale,
+        "fill",         Array::luaFill,
+        "copy_range",   Array::luaCopyRange,
         "type",         getLuaTypename,
-        "pairs",        SharedTable::globalLuaPairs,
-        "ipairs",       SharedTable::globalLuaIPairs,
-        "next",         SharedTable::globalLuaNext,
+        "pairs",        luaPairs,
+        "ipairs",       luaIPairs,
+        "next",         luaNext,
+        "range",        SharedTable::luaRange,
         "size",         luaSize,
+        "memory",       luaMemory,
         "dump",         luaDump,
+        "save",         luaSaveSnapshot,
+        "load",         luaLoadSnapshot,
         "hardware_threads", std::thread::hardware_concurrency,
+        "allocator_stats", allocatorStats,
         sol::meta_function::index, luaIndex
     );
 
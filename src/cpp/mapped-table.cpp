@@ -0,0 +1,651 @@
+#include "mapped-table.h"
+#include "string-pool.h"
+#include "file-replacement.h"
+
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   include <windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+namespace effil {
+
+namespace {
+
+// File layout, all records are aligned by 8 bytes:
+//   header
+//   table records: header, hash buckets and entries, sequence goes first
+//   string records: size and bytes
+// Values refer to strings and nested tables by offsets, so shared tables
+// and cycles are stored once. Numbers are stored in the native byte order.
+const char MAPPED_MAGIC[8] = {'E', 'F', 'F', 'I', 'L', 'M', 'A', 'P'};
+constexpr uint32_t MAPPED_VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARKER = 0x01020304;
+constexpr uint64_t RECORD_ALIGNMENT = 8;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t sizeSize; // hashes of strings depend on size_t
+    uint32_t numberSize;
+    uint64_t fileSize;
+    uint64_t root;
+};
+
+enum class ValueType : uint64_t {
+    Boolean = 1,
+    Integer,
+    Number,
+    String,
+    Table
+};
+
+struct Value {
+    ValueType type;
+    uint64_t payload; // boolean, integer, bits of number or offset of the record
+};
+
+struct Entry {
+    uint64_t hash;
+    Value key;
+    Value value;
+};
+
+struct TableRecord {
+    uint64_t count;
+    uint64_t length;       // keys 1..length are the first entries
+    uint64_t bucketsCount; // power of two
+    // followed by uint64_t buckets[bucketsCount]: entry index + 1 or 0 for empty bucket
+    // and Entry entries[count]
+};
+
+struct StringRecord {
+    uint64_t size;
+    // followed by bytes
+};
+
+static_assert(sizeof(lua_Number) <= sizeof(uint64_t), "number doesn't fit into payload");
+
+// Key of the lookup, integral numbers are the same keys as integers like in Lua 5.3
+struct Key {
+    ValueType type;
+    uint64_t payload;
+    const char* data;
+    size_t size;
+    uint64_t hash;
+};
+
+uint64_t mixHash(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ull;
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t numberBits(lua_Number number) {
+    uint64_t bits = 0;
+    std::memcpy(&bits, &number, sizeof(number));
+    return bits;
+}
+
+lua_Number bitsToNumber(uint64_t bits) {
+    lua_Number number;
+    std::memcpy(&number, &bits, sizeof(number));
+    return number;
+}
+
+Key integerKey(int64_t value) {
+    Key key{ValueType::Integer, static_cast<uint64_t>(value), nullptr, 0, 0};
+    key.hash = mixHash(key.payload);
+    return key;
+}
+
+// Returns false for values which can't be keys of mapped tables
+bool readKey(lua_State* state, int index, Key& key) {
+    switch (lua_type(state, index)) {
+        case LUA_TBOOLEAN:
+            key = Key{ValueType::Boolean, lua_toboolean(state, index) ? 1u : 0u, nullptr, 0, 0};
+            key.hash = mixHash(key.payload ^ 0x9e3779b97f4a7c15ull);
+            return true;
+        case LUA_TNUMBER: {
+#if LUA_VERSION_NUM == 503
+            if (lua_isinteger(state, index)) {
+                key = integerKey(static_cast<int64_t>(lua_tointeger(state, index)));
+                return true;
+            }
+#endif // LUA_VERSION_NUM == 503
+            const lua_Number number = lua_tonumber(state, index);
+            if (std::floor(number) == number && number >= -9223372036854775808.0 && number < 9223372036854775808.0) {
+                key = integerKey(static_cast<int64_t>(number));
+                return true;
+            }
+            key = Key{ValueType::Number, numberBits(number), nullptr, 0, 0};
+            key.hash = mixHash(~key.payload);
+            return true;
+        }
+        case LUA_TSTRING:
+            key = Key{ValueType::String, 0, nullptr, 0, 0};
+            key.data = lua_tolstring(state, index, &key.size);
+            key.hash = mixHash(hashString(key.data, key.size));
+            return true;
+        default:
+            return false;
+    }
+}
+
+uint64_t alignRecord(uint64_t offset) {
+    return (offset + RECORD_ALIGNMENT - 1) & ~(RECORD_ALIGNMENT - 1);
+}
+
+uint64_t bucketsOffset(uint64_t tableOffset) {
+    return tableOffset + sizeof(TableRecord);
+}
+
+uint64_t entriesOffset(uint64_t tableOffset, uint64_t bucketsCount) {
+    return bucketsOffset(tableOffset) + bucketsCount * sizeof(uint64_t);
+}
+
+// Builds the whole file in memory, tables are written in the breadth-first order,
+// so deep nesting doesn't consume C stack
+class MappedFileBuilder {
+public:
+    explicit MappedFileBuilder(lua_State* state) : state_(state) {}
+
+    ~MappedFileBuilder() {
+        for (const auto& table : pending_)
+            luaL_unref(state_, LUA_REGISTRYINDEX, table.reference);
+    }
+
+    const std::vector<char>& build(int index) {
+        allocate(sizeof(FileHeader));
+        const uint64_t root = tableOffset(index);
+        while (!pending_.empty()) {
+            const PendingTable table = pending_.front();
+            pending_.pop_front();
+            lua_rawgeti(state_, LUA_REGISTRYINDEX, table.reference);
+            luaL_unref(state_, LUA_REGISTRYINDEX, table.reference);
+            fillTable(lua_gettop(state_), table.offset);
+            lua_pop(state_, 1);
+        }
+
+        FileHeader header;
+        std::memcpy(header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC));
+        header.version = MAPPED_VERSION;
+        header.byteOrder = BYTE_ORDER_MARKER;
+        header.sizeSize = sizeof(size_t);
+        header.numberSize = sizeof(lua_Number);
+        header.fileSize = data_.size();
+        header.root = root;
+        store(0, header);
+        return data_;
+    }
+
+private:
+    struct PendingTable {
+        int reference;
+        uint64_t offset;
+    };
+
+    uint64_t allocate(uint64_t size) {
+        const uint64_t offset = alignRecord(data_.size());
+        data_.resize(static_cast<size_t>(offset + size));
+        return offset;
+    }
+
+    template <typename T>
+    void store(uint64_t offset, const T& value) {
+        std::memcpy(data_.data() + offset, &value, sizeof(value));
+    }
+
+    template <typename T>
+    T load(uint64_t offset) const {
+        T value;
+        std::memcpy(&value, data_.data() + offset, sizeof(value));
+        return value;
+    }
+
+    // Allocates the record of the table met first time, entries are filled later.
+    // Index must be absolute.
+    uint64_t tableOffset(int index) {
+        const void* pointer = lua_topointer(state_, index);
+        const auto iter = tables_.find(pointer);
+        if (iter != tables_.end())
+            return iter->second;
+
+        uint64_t count = 0;
+        lua_pushnil(state_);
+        while (lua_next(state_, index)) {
+            ++count;
+            lua_pop(state_, 1);
+        }
+        uint64_t bucketsCount = 1;
+        while (bucketsCount < count * 2)
+            bucketsCount <<= 1;
+
+        const uint64_t offset = allocate(sizeof(TableRecord) + bucketsCount * sizeof(uint64_t) + count * sizeof(Entry));
+        store(offset, TableRecord{count, 0, bucketsCount});
+        // Source tables are reachable from the root one, so pointers stay unique
+        tables_.emplace(pointer, offset);
+        lua_pushvalue(state_, index);
+        pending_.push_back({luaL_ref(state_, LUA_REGISTRYINDEX), offset});
+        return offset;
+    }
+
+    uint64_t stringOffset(const char* data, size_t size) {
+        std::string value(data, size);
+        const auto iter = strings_.find(value);
+        if (iter != strings_.end())
+            return iter->second;
+
+        const uint64_t offset = allocate(sizeof(StringRecord) + size);
+        store(offset, StringRecord{size});
+        if (size != 0)
+            std::memcpy(data_.data() + offset + sizeof(StringRecord), data, size);
+        strings_.emplace(std::move(value), offset);
+        return offset;
+    }
+
+    Value valueAt(int index) {
+        switch (lua_type(state_, index)) {
+            case LUA_TBOOLEAN:
+                return Value{ValueType::Boolean, lua_toboolean(state_, index) ? 1u : 0u};
+            case LUA_TNUMBER:
+#if LUA_VERSION_NUM == 503
+                if (lua_isinteger(state_, index))
+                    return Value{ValueType::Integer, static_cast<uint64_t>(static_cast<int64_t>(lua_tointeger(state_, index)))};
+#endif // LUA_VERSION_NUM == 503
+                return Value{ValueType::Number, numberBits(lua_tonumber(state_, index))};
+            case LUA_TSTRING: {
+                size_t size = 0;
+                const char* data = lua_tolstring(state_, index, &size);
+                return Value{ValueType::String, stringOffset(data, size)};
+            }
+            case LUA_TTABLE:
+                return Value{ValueType::Table, tableOffset(index)};
+            default:
+                throw Exception() << "unable to store " << luaL_typename(state_, index) << " in effil.mmap_table";
+        }
+    }
+
+    void writeEntry(uint64_t table, const TableRecord& record, uint64_t position, const Key& key, const Value& value) {
+        const Value storedKey = key.type == ValueType::String
+                ? Value{ValueType::String, stringOffset(key.data, key.size)}
+                : Value{key.type, key.payload};
+        store(entriesOffset(table, record.bucketsCount) + position * sizeof(Entry), Entry{key.hash, storedKey, value});
+
+        const uint64_t mask = record.bucketsCount - 1;
+        for (uint64_t bucket = key.hash & mask;; bucket = (bucket + 1) & mask) {
+            const uint64_t bucketOffset = bucketsOffset(table) + bucket * sizeof(uint64_t);
+            if (load<uint64_t>(bucketOffset) == 0) {
+                store(bucketOffset, position + 1);
+                return;
+            }
+        }
+    }
+
+    void fillTable(int index, uint64_t table) {
+        TableRecord record = load<TableRecord>(table);
+        uint64_t position = 0;
+
+        // Sequence goes first, so # and ipairs don't require lookups
+        for (;;) {
+            lua_rawgeti(state_, index, static_cast<int>(record.length + 1));
+            if (lua_isnil(state_, -1)) {
+                lua_pop(state_, 1);
+                break;
+            }
+            ++record.length;
+            const Value value = valueAt(lua_gettop(state_));
+            writeEntry(table, record, position++, integerKey(static_cast<int64_t>(record.length)), value);
+            lua_pop(state_, 1);
+        }
+
+        lua_pushnil(state_);
+        while (lua_next(state_, index)) {
+            Key key;
+            REQUIRE(readKey(state_, -2, key))
+                    << "unable to store " << luaL_typename(state_, -2) << " key in effil.mmap_table";
+            const auto integer = static_cast<int64_t>(key.payload);
+            if (key.type != ValueType::Integer || integer < 1 || static_cast<uint64_t>(integer) > record.length) {
+                const Value value = valueAt(lua_gettop(state_));
+                writeEntry(table, record, position++, key, value);
+            }
+            lua_pop(state_, 1);
+        }
+        assert(position == record.count);
+        store(table, record);
+    }
+
+    lua_State* state_;
+    std::vector<char> data_;
+    std::unordered_map<const void*, uint64_t> tables_;
+    std::unordered_map<std::string, uint64_t> strings_;
+    std::deque<PendingTable> pending_;
+};
+
+void writeFile(const std::string& path, const std::vector<char>& data) {
+    // The file is replaced at once, so processes which map the old one aren't affected
+    FileReplacement file(path);
+    file.write(data.data(), data.size());
+    file.commit();
+}
+
+} // namespace
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) : path_(path) {
+#ifdef _WIN32
+        const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        REQUIRE(file != INVALID_HANDLE_VALUE) << "unable to open '" << path << "'";
+        ScopeGuard closeFile([&] { CloseHandle(file); });
+
+        LARGE_INTEGER size;
+        REQUIRE(GetFileSizeEx(file, &size)) << "unable to get size of '" << path << "'";
+        size_ = static_cast<uint64_t>(size.QuadPart);
+        REQUIRE(size_ >= sizeof(FileHeader)) << "'" << path << "' is not a mapped table";
+
+        const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        REQUIRE(mapping != nullptr) << "unable to map '" << path << "'";
+        ScopeGuard closeMapping([&] { CloseHandle(mapping); });
+        data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        REQUIRE(data_ != nullptr) << "unable to map '" << path << "'";
+#else
+        const int file = ::open(path.c_str(), O_RDONLY);
+        REQUIRE(file >= 0) << "unable to open '" << path << "'";
+        ScopeGuard closeFile([&] { ::close(file); });
+
+        struct stat info;
+        REQUIRE(fstat(file, &info) == 0) << "unable to get size of '" << path << "'";
+        size_ = static_cast<uint64_t>(info.st_size);
+        REQUIRE(size_ >= sizeof(FileHeader)) << "'" << path << "' is not a mapped table";
+
+        void* data = mmap(nullptr, static_cast<size_t>(size_), PROT_READ, MAP_SHARED, file, 0);
+        REQUIRE(data != MAP_FAILED) << "unable to map '" << path << "'";
+        data_ = static_cast<const char*>(data);
+#endif // _WIN32
+
+        try {
+            const auto& header = *at<FileHeader>(0);
+            REQUIRE(std::memcmp(header.magic, MAPPED_MAGIC, sizeof(MAPPED_MAGIC)) == 0)
+                    << "'" << path << "' is not a mapped table";
+            REQUIRE(header.byteOrder == BYTE_ORDER_MARKER && header.sizeSize == sizeof(size_t) &&
+                    header.numberSize == sizeof(lua_Number))
+                    << "mapped table '" << path << "' is created on incompatible platform";
+            REQUIRE(header.version == MAPPED_VERSION) << "unsupported version of mapped table " << header.version;
+            REQUIRE(header.fileSize == size_) << "mapped table '" << path << "' is truncated";
+            root_ = header.root;
+        }
+        catch (...) {
+            unmap();
+            throw;
+        }
+    }
+
+    ~MappedFile() { unmap(); }
+
+    uint64_t root() const { return root_; }
+
+    // Offsets are checked, so corrupted file can't lead to reads out of the mapping
+    template <typename T>
+    const T* at(uint64_t offset, uint64_t count = 1) const {
+        REQUIRE(offset % alignof(T) == 0 && offset <= size_ && count <= (size_ - offset) / sizeof(T))
+                << "mapped table '" << path_ << "' is corrupted";
+        return reinterpret_cast<const T*>(data_ + offset);
+    }
+
+    const char* bytes(uint64_t offset, uint64_t size) const { return at<char>(offset, size); }
+
+    const std::string& path() const { return path_; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    void unmap() {
+#ifdef _WIN32
+        UnmapViewOfFile(data_);
+#else
+        munmap(const_cast<char*>(data_), static_cast<size_t>(size_));
+#endif // _WIN32
+    }
+
+    std::string path_;
+    const char* data_ = nullptr;
+    uint64_t size_ = 0;
+    uint64_t root_ = 0;
+};
+
+namespace {
+
+// Table record with validated sizes
+struct TableView {
+    const TableRecord* record;
+    const uint64_t* buckets;
+    const Entry* entries;
+};
+
+TableView tableAt(const MappedFile& file, uint64_t offset) {
+    const TableRecord* record = file.at<TableRecord>(offset);
+    const uint64_t bucketsCount = record->bucketsCount;
+    REQUIRE(bucketsCount != 0 && (bucketsCount & (bucketsCount - 1)) == 0 &&
+            record->count <= bucketsCount && record->length <= record->count)
+            << "mapped table '" << file.path() << "' is corrupted";
+    const uint64_t* buckets = file.at<uint64_t>(bucketsOffset(offset), bucketsCount);
+    const Entry* entries = file.at<Entry>(entriesOffset(offset, bucketsCount), record->count);
+    return TableView{record, buckets, entries};
+}
+
+const Entry* findEntry(const MappedFile& file, const TableView& table, const Key& key) {
+    if (key.type == ValueType::Integer) {
+        const auto index = static_cast<int64_t>(key.payload);
+        if (index >= 1 && static_cast<uint64_t>(index) <= table.record->length)
+            return &table.entries[index - 1];
+    }
+
+    const uint64_t mask = table.record->bucketsCount - 1;
+    for (uint64_t bucket = key.hash & mask, probes = 0; probes <= mask; bucket = (bucket + 1) & mask, ++probes) {
+        const uint64_t position = table.buckets[bucket];
+        if (position == 0)
+            return nullptr;
+        REQUIRE(position <= table.record->count) << "mapped table '" << file.path() << "' is corrupted";
+
+        const Entry& entry = table.entries[position - 1];
+        if (entry.hash != key.hash || entry.key.type != key.type)
+            continue;
+        if (key.type != ValueType::String) {
+            if (entry.key.payload == key.payload)
+                return &entry;
+            continue;
+        }
+        const uint64_t size = file.at<StringRecord>(entry.key.payload)->size;
+        if (size == key.size &&
+                std::memcmp(file.bytes(entry.key.payload + sizeof(StringRecord), size), key.data, key.size) == 0)
+            return &entry;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+MappedTable MappedTable::create(const std::string& path, const sol::table& source) {
+    lua_State* state = source.lua_state();
+    sol::stack::push(state, source);
+    ScopeGuard popSource([&] { lua_pop(state, 1); });
+    {
+        MappedFileBuilder builder(state);
+        writeFile(path, builder.build(lua_gettop(state)));
+    }
+    return open(path);
+}
+
+MappedTable MappedTable::open(const std::string& path) {
+    auto file = std::make_shared<const MappedFile>(path);
+    const uint64_t root = file->root();
+    tableAt(*file, root);
+    return MappedTable(std::move(file), root);
+}
+
+void MappedTable::exportAPI(sol::state_view& lua) {
+    sol::usertype<MappedTable> type("new", sol::no_constructor,
+        "__pairs",  &MappedTable::luaPairs,
+        "__ipairs", &MappedTable::luaIPairs,
+        sol::meta_function::index,      &MappedTable::luaIndex,
+        sol::meta_function::new_index,  &MappedTable::luaNewIndex,
+        sol::meta_function::length,     &MappedTable::luaLength,
+        sol::meta_function::to_string,  &MappedTable::luaToString,
+        sol::meta_function::equal_to,   &MappedTable::luaEq
+    );
+    sol::stack::push(lua, type);
+    sol::stack::pop<sol::object>(lua);
+}
+
+namespace {
+
+sol::object pushValue(lua_State* state, const std::shared_ptr<const MappedFile>& file, const Value& value);
+
+} // namespace
+
+size_t MappedTable::size() const {
+    return static_cast<size_t>(tableAt(*file_, offset_).record->count);
+}
+
+bool MappedTable::less(const MappedTable& other) const {
+    if (file_ != other.file_)
+        return std::less<const MappedFile*>()(file_.get(), other.file_.get());
+    return offset_ < other.offset_;
+}
+
+size_t MappedTable::hash() const {
+    return static_cast<size_t>(mixHash(reinterpret_cast<uintptr_t>(file_.get()) ^ offset_));
+}
+
+sol::object MappedTable::luaIndex(const sol::stack_object& luaKey, sol::this_state state) const {
+    try {
+        Key key;
+        if (!readKey(state, luaKey.stack_index(), key))
+            return sol::nil;
+        const Entry* entry = findEntry(*file_, tableAt(*file_, offset_), key);
+        if (entry == nullptr)
+            return sol::nil;
+        return pushValue(state, file_, entry->value);
+    } RETHROW_WITH_PREFIX("effil.mmap_table");
+}
+
+void MappedTable::luaNewIndex(const sol::stack_object&, const sol::stack_object&) {
+    throw Exception() << "effil.mmap_table: attempt to modify read-only table";
+}
+
+size_t MappedTable::luaLength() const {
+    try {
+        return static_cast<size_t>(tableAt(*file_, offset_).record->length);
+    } RETHROW_WITH_PREFIX("effil.mmap_table");
+}
+
+std::string MappedTable::luaToString() const {
+    std::stringstream ss;
+    ss << "effil.mmap_table: " << file_.get() << "+" << offset_;
+    return ss.str();
+}
+
+MappedTable::PairsIterator MappedTable::next(const sol::stack_object& luaKey, sol::this_state state) const {
+    try {
+        const TableView table = tableAt(*file_, offset_);
+        uint64_t position = 0;
+        if (luaKey.valid() && luaKey.get_type() != sol::type::nil) {
+            Key key;
+            const Entry* entry = readKey(state, luaKey.stack_index(), key)
+                    ? findEntry(*file_, table, key)
+                    : nullptr;
+            REQUIRE(entry != nullptr) << "invalid key to 'next'";
+            position = static_cast<uint64_t>(entry - table.entries) + 1;
+        }
+        if (position == table.record->count)
+            return PairsIterator(sol::nil, sol::nil);
+
+        const Entry& entry = table.entries[position];
+        sol::object key = pushValue(state, file_, entry.key);
+        return PairsIterator(std::move(key), pushValue(state, file_, entry.value));
+    } RETHROW_WITH_PREFIX("effil.mmap_table");
+}
+
+MappedTable::PairsIterator MappedTable::pairsNext(sol::this_state state, const MappedTable& table,
+                                                  const sol::stack_object& key) {
+    return table.next(key, state);
+}
+
+MappedTable::PairsIterator MappedTable::ipairsNext(sol::this_state state, const MappedTable& table,
+                                                   const sol::optional<LUA_INDEX_TYPE>& key) {
+    try {
+        const uint64_t index = key ? static_cast<uint64_t>(key.value()) + 1 : 1;
+        const TableView view = tableAt(*table.file_, table.offset_);
+        // Sequence is stored without holes, so iteration stops at its end
+        if (index > view.record->length)
+            return PairsIterator(sol::nil, sol::nil);
+        return PairsIterator(sol::make_object(state, static_cast<LUA_INDEX_TYPE>(index)),
+                             pushValue(state, table.file_, view.entries[index - 1].value));
+    } RETHROW_WITH_PREFIX("effil.mmap_table");
+}
+
+MappedTable::PairsIterator MappedTable::luaPairs(sol::this_state state) const {
+    return PairsIterator(sol::make_object(state, &MappedTable::pairsNext).as<sol::function>(),
+                         sol::make_object(state, *this));
+}
+
+MappedTable::PairsIterator MappedTable::luaIPairs(sol::this_state state) const {
+    return PairsIterator(sol::make_object(state, &MappedTable::ipairsNext).as<sol::function>(),
+                         sol::make_object(state, *this));
+}
+
+namespace {
+
+sol::object pushValue(lua_State* state, const std::shared_ptr<const MappedFile>& file, const Value& value) {
+    switch (value.type) {
+        case ValueType::Boolean:
+            lua_pushboolean(state, value.payload != 0);
+            break;
+        case ValueType::Integer:
+#if LUA_VERSION_NUM == 503
+            lua_pushinteger(state, static_cast<lua_Integer>(static_cast<int64_t>(value.payload)));
+#else
+            lua_pushnumber(state, static_cast<lua_Number>(static_cast<int64_t>(value.payload)));
+#endif // LUA_VERSION_NUM == 503
+            break;
+        case ValueType::Number:
+            lua_pushnumber(state, bitsToNumber(value.payload));
+            break;
+        case ValueType::String: {
+            const uint64_t size = file->at<StringRecord>(value.payload)->size;
+            const char* data = file->bytes(value.payload + sizeof(StringRecord), size);
+            lua_pushlstring(state, data, static_cast<size_t>(size));
+            break;
+        }
+        case ValueType::Table:
+            tableAt(*file, value.payload);
+            return sol::make_object(state, MappedTable(file, value.payload));
+        default:
+            throw Exception() << "mapped table '" << file->path() << "' is corrupted";
+    }
+    return sol::stack::pop<sol::object>(state);
+}
+
+} // namespace
+
+} // namespace effil
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "utils.h"
+
+#include <sol.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace effil {
+
+// Read-only file mapped into memory.
+// Mapping lives while any table stored in the file is referenced.
+class MappedFile;
+
+// Read-only table stored in the memory-mapped file.
+// Entries are kept in the hashed layout, so the file is opened without
+// any conversion and pages of the file are shared between processes.
+// Tables aren't managed by GC: they never refer to other effil objects.
+class MappedTable {
+public:
+    typedef std::pair<sol::object, sol::object> PairsIterator;
+
+    static void exportAPI(sol::state_view& lua);
+
+    // Writes the Lua table and all nested ones into the file and maps it
+    static MappedTable create(const std::string& path, const sol::table& source);
+    static MappedTable open(const std::string& path);
+
+    // View of the table record stored in the file
+    MappedTable(std::shared_ptr<const MappedFile> file, uint64_t offset)
+            : file_(std::move(file)), offset_(offset) {}
+
+    size_t size() const;
+    bool equals(const MappedTable& other) const { return file_ == other.file_ && offset_ == other.offset_; }
+    bool less(const MappedTable& other) const;
+    size_t hash() const;
+
+    // These functions are metamethods available in Lua
+    sol::object luaIndex(const sol::stack_object& key, sol::this_state state) const;
+    void luaNewIndex(const sol::stack_object& key, const sol::stack_object& value);
+    size_t luaLength() const;
+    std::string luaToString() const;
+    PairsIterator luaPairs(sol::this_state state) const;
+    PairsIterator luaIPairs(sol::this_state state) const;
+    static bool luaEq(const MappedTable& left, const MappedTable& right) { return left.equals(right); }
+
+    // effil.next for mapped tables
+    PairsIterator next(const sol::stack_object& key, sol::this_state state) const;
+
+private:
+    static PairsIterator pairsNext(sol::this_state state, const MappedTable& table, const sol::stack_object& key);
+    static PairsIterator ipairsNext(sol::this_state state, const MappedTable& table,
+                                    const sol::optional<LUA_INDEX_TYPE>& key);
+
+    std::shared_ptr<const MappedFile> file_;
+    uint64_t offset_; // offset of the table record in the file
+};
+
+} // namespace effil
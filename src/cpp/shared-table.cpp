@@ -3,7 +3,10 @@
 
 #include "utils.h"
 
+#include <algorithm>
 #include <cassert>
+#include <limits>
+#include <queue>
 #include <shared_mutex>
 
 namespace effil {
@@ -23,8 +26,132 @@ bool isAnyTable(const SolObject& obj) {
     return obj.valid() && ((obj.get_type() == sol::type::userdata && obj.template is<SharedTable>()) || obj.get_type() == sol::type::table);
 }
 
+struct MetamethodKey {
+    StoredObject key;
+    uint64_t hash;
+};
+
+// Keys are created once, so lookup of metamethods doesn't allocate strings
+const std::vector<MetamethodKey>& metamethodKeys() {
+    static const std::vector<MetamethodKey> keys = [] {
+        // order matches Metamethod enumeration
+        const char* names[] = {
+            "__index", "__newindex", "__call", "__tostring", "__len", "__pairs", "__ipairs",
+            "__unm", "__eq", "__lt", "__le", "__concat",
+            "__add", "__sub", "__mul", "__div", "__mod", "__pow"
+        };
+        static_assert(sizeof(names) / sizeof(names[0]) == static_cast<size_t>(Metamethod::Count),
+                      "Names of metamethods don't match Metamethod enumeration");
+
+        std::vector<MetamethodKey> result;
+        for (const char* name : names) {
+            StoredObject key = createStoredObject(name);
+            const uint64_t hash = TableStorage::hashOf(key);
+            result.push_back(MetamethodKey{std::move(key), hash});
+        }
+        return result;
+    }();
+    return keys;
+}
+
+// Cached presence of metamethods is tagged by the lower bits of the shard version
+constexpr unsigned METAMETHODS_BITS = 24;
+constexpr uint64_t VERSION_MASK = static_cast<uint64_t>(-1) >> METAMETHODS_BITS;
+static_assert(static_cast<unsigned>(Metamethod::Count) <= METAMETHODS_BITS, "Too many metamethods");
+
+void bumpVersion(SharedTableData::Shard& shard) {
+    // modifications are serialized by the shard lock
+    shard.version.store(shard.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+// Shards are always locked in the same order
+template <typename Lock>
+std::vector<Lock> lockShards(SharedTableData& data) {
+    std::vector<Lock> locks;
+    locks.reserve(data.shardsCount);
+    for (size_t i = 0; i < data.shardsCount; ++i)
+        locks.emplace_back(data.shards[i].lock);
+    return locks;
+}
+
+// Frozen tables are never modified, so they are read without locking
+SharedLock lockForRead(const SharedTableData& data, SpinMutex& mutex) {
+    if (data.frozen.load(std::memory_order_acquire))
+        return SharedLock();
+    return SharedLock(mutex);
+}
+
+std::vector<SharedLock> lockShardsForRead(SharedTableData& data) {
+    if (data.frozen.load(std::memory_order_acquire))
+        return {};
+    return lockShards<SharedLock>(data);
+}
+
+// Only numbers and strings are ordered, other keys aren't indexed
+bool isRangeKey(const StoredObject& key) {
+    return storedObjectToNumber(key) || storedObjectToStringPointer(key) != nullptr;
+}
+
 } // namespace
 
+StoredObject SharedTableData::metamethod(Metamethod method) {
+    const auto& keys = metamethodKeys();
+    const auto& methodKey = keys[static_cast<size_t>(method)];
+    auto& methodShard = shardByHash(methodKey.hash);
+
+    const uint64_t version = methodShard.version.load(std::memory_order_acquire) & VERSION_MASK;
+    uint64_t cached = methodShard.metamethods.load(std::memory_order_acquire);
+    if ((cached >> METAMETHODS_BITS) != version) {
+        cached = version << METAMETHODS_BITS;
+        const auto g = lockForRead(*this, methodShard.lock);
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (&shardByHash(keys[i].hash) == &methodShard && methodShard.entries.find(keys[i].key))
+                cached |= 1ull << i;
+        }
+        methodShard.metamethods.store(cached, std::memory_order_release);
+    }
+
+    if ((cached & (1ull << static_cast<unsigned>(method))) == 0)
+        return nullptr;
+
+    const auto g = lockForRead(*this, methodShard.lock);
+    const StoredObject* value = methodShard.entries.find(methodKey.key);
+    return value ? *value : nullptr;
+}
+
+size_t SharedTableData::memory() const {
+    size_t total = sizeof(SharedTableData) + shardsCount * sizeof(Shard) + referencesMemory();
+    for (size_t i = 0; i < shardsCount; ++i) {
+        auto& shard = shards[i];
+        const auto g = lockForRead(*this, shard.lock);
+        total += shard.entries.memory();
+        // tree nodes contain three pointers and color besides the key
+        if (shard.rangeIndexed.load(std::memory_order_acquire))
+            total += shard.rangeIndex.size() * (sizeof(StoredObject) + 4 * sizeof(void*));
+    }
+    return total;
+}
+
+void SharedTableData::notifyWaiters(const StoredKeyView& key) {
+    // Waiter is registered before it reads the value under the shard lock,
+    // so the shard lock orders registration and modification
+    if (waitersCount.load(std::memory_order_relaxed) == 0)
+        return;
+
+    const uint64_t hash = TableStorage::hashOf(key);
+    std::lock_guard<std::mutex> g(waitersLock);
+    for (TableWaiter* waiter : waiters) {
+        if (waiter->hash == hash)
+            waiter->notify();
+    }
+}
+
+void SharedTableData::interruptWaiters() {
+    std::lock_guard<std::mutex> g(waitersLock);
+    for (TableWaiter* waiter : waiters)
+        waiter->interrupt();
+}
+
 void SharedTable::exportAPI(sol::state_view& lua) {
     sol::usertype<SharedTable> type("new", sol::no_constructor,
         "__pairs",  &SharedTable::luaPairs,
@@ -50,25 +177,72 @@ void SharedTable::exportAPI(sol::state_view& lua) {
     sol::stack::pop<sol::object>(lua);
 }
 
+void SharedTable::initialize(size_t shards) {
+    assert(shards > 0);
+    ctx_->shards.reset(new SharedTableData::Shard[shards]);
+    ctx_->shardsCount = shards;
+}
+
 void SharedTable::set(StoredObject&& key, StoredObject&& value) {
-    UniqueLock g(ctx_->lock);
+    auto& shard = ctx_->shard(key);
+    UniqueLock g(shard.lock);
+    setEntry(shard, std::move(key), std::move(value));
+}
+
+void SharedTable::setMany(StoredArray&& sequence, StoredEntries&& entries) {
+    const auto locks = lockShards<UniqueLock>(*ctx_);
+    checkNotFrozen();
+    if (ctx_->shardsCount == 1)
+        ctx_->shards[0].entries.reserve(sequence.size(), entries.size());
+
+    for (size_t i = 0; i < sequence.size(); ++i) {
+        StoredObject key = createStoredObject(static_cast<LUA_INDEX_TYPE>(i + 1));
+        auto& shard = ctx_->shard(key);
+        setEntry(shard, std::move(key), std::move(sequence[i]));
+    }
+    for (auto& entry : entries) {
+        auto& shard = ctx_->shard(entry.first);
+        setEntry(shard, std::move(entry.first), std::move(entry.second));
+    }
+}
+
+void SharedTable::checkNotFrozen() const {
+    REQUIRE(!ctx_->frozen.load(std::memory_order_relaxed)) << "attempt to modify frozen table";
+}
 
-    ctx_->addReference(key->gcHandle());
-    ctx_->addReference(value->gcHandle());
+void SharedTable::setEntry(SharedTableData::Shard& shard, StoredObject&& key, StoredObject&& value) {
+    checkNotFrozen();
+    const GCHandle keyHandle = key.gcHandle();
+    ctx_->addReference(value.gcHandle());
 
-    key->releaseStrongReference();
-    value->releaseStrongReference();
+    key.releaseStrongReference();
+    value.releaseStrongReference();
 
-    ctx_->entries[std::move(key)] = std::move(value);
+    // waiters read the new value after the shard is unlocked
+    ctx_->notifyWaiters(key);
+    StoredObject indexedKey;
+    if (shard.rangeIndexed.load(std::memory_order_relaxed) && isRangeKey(key))
+        indexedKey = key;
+    const StoredObject replaced = shard.entries.set(std::move(key), std::move(value));
+    bumpVersion(shard);
+    if (replaced) {
+        ctx_->removeReference(replaced.gcHandle());
+    }
+    else {
+        ctx_->addReference(keyHandle);
+        if (indexedKey)
+            shard.rangeIndex.insert(std::move(indexedKey));
+    }
 }
 
-sol::object SharedTable::get(const StoredObject& key, sol::this_state state) const {
-    SharedLock g(ctx_->lock);
-    const auto val = ctx_->entries.find(key);
-    if (val == ctx_->entries.end()) {
+sol::object SharedTable::get(const StoredKeyView& key, sol::this_state state) const {
+    auto& shard = ctx_->shard(key);
+    const auto g = lockForRead(*ctx_, shard.lock);
+    const StoredObject* val = shard.entries.find(key);
+    if (val == nullptr) {
         return sol::nil;
     } else {
-        return val->second->unpack(state);
+        return val->unpack(state);
     }
 }
 
@@ -77,70 +251,161 @@ void SharedTable::rawSet(const sol::stack_object& luaKey, const sol::stack_objec
 
     StoredObject key = createStoredObject(luaKey);
     if (luaValue.get_type() == sol::type::nil) {
-        UniqueLock g(ctx_->lock);
-
-        // in this case object is not obligatory to own data
-        auto it = ctx_->entries.find(key);
-        if (it != ctx_->entries.end()) {
-            ctx_->removeReference(it->first->gcHandle());
-            ctx_->removeReference(it->second->gcHandle());
-            ctx_->entries.erase(it);
-        }
-
+        auto& shard = ctx_->shard(key);
+        UniqueLock g(shard.lock);
+        removeEntry(shard, key);
     } else {
         set(std::move(key), createStoredObject(luaValue));
     }
 }
 
+void SharedTable::removeEntry(SharedTableData::Shard& shard, const StoredObject& key) {
+    checkNotFrozen();
+    // in this case object is not obligatory to own data
+    const auto removed = shard.entries.erase(key);
+    if (removed.key) {
+        bumpVersion(shard);
+        if (shard.rangeIndexed.load(std::memory_order_relaxed) && isRangeKey(removed.key))
+            shard.rangeIndex.erase(removed.key);
+        ctx_->notifyWaiters(removed.key);
+        ctx_->removeReference(removed.key.gcHandle());
+        ctx_->removeReference(removed.value.gcHandle());
+    }
+}
+
 sol::object SharedTable::rawGet(const sol::stack_object& luaKey, sol::this_state state) const {
     REQUIRE(luaKey.valid()) << "Indexing by nil";
-    StoredObject key = createStoredObject(luaKey);
-    return get(key, state);
+    return withStoredKeyView(luaKey, [&](const StoredKeyView& key) { return get(key, state); });
+}
+
+SharedTable SharedTable::fromHandle(GCHandle handle) {
+    auto* data = static_cast<SharedTableData*>(handle);
+    return SharedTable(std::static_pointer_cast<SharedTableData>(data->shared_from_this()));
 }
 
 sol::object SharedTable::luaDump(sol::this_state state, BaseHolder::DumpCache& cache) const {
+    std::vector<SharedTable> pending;
+    const int ref = createDumpTable(state, cache, pending);
+    while (!pending.empty()) {
+        const SharedTable table = std::move(pending.back());
+        pending.pop_back();
+        table.dumpEntries(state, cache, pending);
+    }
+    lua_rawgeti(state, LUA_REGISTRYINDEX, ref);
+    return sol::stack::pop<sol::object>(state);
+}
+
+int SharedTable::createDumpTable(lua_State* state, BaseHolder::DumpCache& cache,
+                                 std::vector<SharedTable>& pending) const {
     const auto iter = cache.find(handle());
-    if (iter == cache.end()) {
-        SharedLock lock(ctx_->lock);
+    if (iter != cache.end())
+        return iter->second;
+
+    size_t arraySize = 0;
+    size_t hashSize = 0;
+    for (size_t i = 0; i < ctx_->shardsCount; ++i) {
+        const auto& shard = ctx_->shards[i];
+        const auto lock = lockForRead(*ctx_, shard.lock);
+        // Integer keys of sharded tables are spread between shards
+        if (ctx_->shardsCount == 1)
+            arraySize = shard.entries.length();
+        hashSize += shard.entries.size();
+    }
+    hashSize -= arraySize;
+
+    lua_createtable(state, static_cast<int>(arraySize), static_cast<int>(hashSize));
+    const int ref = luaL_ref(state, LUA_REGISTRYINDEX);
+    cache.emplace(handle(), ref);
+    pending.push_back(*this);
+    return ref;
+}
+
+namespace {
 
-        auto result = sol::table::create(state.L);
-        cache.insert(iter, {handle(), result.registry_index()});
-        for (const auto& pair: ctx_->entries) {
-            result.set(pair.first->convertToLua(state, cache),
-                       pair.second->convertToLua(state, cache));
+void pushDumped(lua_State* state, const StoredObject& object, BaseHolder::DumpCache& cache) {
+    const BaseHolder* holder = object.holder();
+    if (holder == nullptr || holder->type() == HolderType::String)
+        object.push(state);
+    else if (holder->type() == HolderType::SharedTable)
+        lua_rawgeti(state, LUA_REGISTRYINDEX, cache.at(object.gcHandle()));
+    else
+        sol::stack::push(state, object.convertToLua(sol::this_state{state}, cache));
+}
+
+} // namespace
+
+void SharedTable::dumpEntries(lua_State* state, BaseHolder::DumpCache& cache,
+                              std::vector<SharedTable>& pending) const {
+    // Entries are copied under the lock and converted after that,
+    // so locks of nested tables are never taken while this one is held.
+    // Other effil objects are pinned, since they may be removed from the table meanwhile.
+    StoredEntries entries;
+    std::vector<SharedTable> nested;
+    std::vector<std::shared_ptr<GCData>> pinned;
+    const auto collectNested = [&](const StoredObject& object) {
+        const GCHandle handle = object.gcHandle();
+        if (handle == GCNull)
+            return;
+        if (object.holder()->type() != HolderType::SharedTable)
+            pinned.push_back(GC::instance().data(handle));
+        else if (cache.count(handle) == 0)
+            nested.push_back(fromHandle(handle));
+    };
+
+    for (size_t i = 0; i < ctx_->shardsCount; ++i) {
+        const auto& shard = ctx_->shards[i];
+        const auto lock = lockForRead(*ctx_, shard.lock);
+        const auto& storage = shard.entries;
+        entries.reserve(entries.size() + storage.size());
+        for (size_t pos = storage.first(); pos != TableStorage::npos; pos = storage.next(pos)) {
+            entries.emplace_back(storage.keyAt(pos), storage.valueAt(pos));
+            collectNested(entries.back().first);
+            collectNested(entries.back().second);
         }
-        if (ctx_->metatable) {
-            const auto mt = GC::instance().get<SharedTable>(ctx_->metatable);
-            lock.unlock();
+    }
 
-            result[sol::metatable_key] = mt.luaDump(state, cache);
+    sol::optional<SharedTable> metatable;
+    {
+        SharedLock lock(ctx_->lock);
+        if (ctx_->metatable) {
+            metatable = fromHandle(ctx_->metatable);
+            nested.push_back(*metatable);
         }
-        return result;
     }
-    return sol::table(state.L, sol::ref_index(iter->second));
+
+    for (const auto& table : nested)
+        table.createDumpTable(state, cache, pending);
+
+    lua_rawgeti(state, LUA_REGISTRYINDEX, cache.at(handle()));
+    const int tableIndex = lua_gettop(state);
+    for (const auto& entry : entries) {
+        pushDumped(state, entry.first, cache);
+        pushDumped(state, entry.second, cache);
+        lua_rawset(state, tableIndex);
+    }
+    if (metatable) {
+        lua_rawgeti(state, LUA_REGISTRYINDEX, cache.at(metatable->handle()));
+        lua_setmetatable(state, tableIndex);
+    }
+    lua_pop(state, 1);
 }
 
 /*
  * Lua Meta API methods
  */
-#define DEFFINE_METAMETHOD_CALL_0(methodName) DEFFINE_METAMETHOD_CALL(methodName, *this)
-#define DEFFINE_METAMETHOD_CALL(methodName, ...) \
+#define DEFFINE_METAMETHOD_CALL_0(method) DEFFINE_METAMETHOD_CALL(*this, method, *this)
+#define DEFFINE_METAMETHOD_CALL(table, method, ...) \
     { \
-        SharedLock lock(ctx_->lock); \
-        if (ctx_->metatable != GCNull) { \
-            auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable); \
-            lock.unlock(); \
-            sol::function handler = tableHolder.get(createStoredObject(methodName), state); \
-            if (handler.valid()) { \
-                return handler(__VA_ARGS__); \
-            } \
+        if (const StoredObject handler = (table).getMetamethod(method)) { \
+            sol::function func = handler.unpack(state); \
+            return func(__VA_ARGS__); \
         } \
     }
 
-#define PROXY_METAMETHOD_IMPL(tableMethod, methodName, errMsg) \
+#define PROXY_METAMETHOD_IMPL(tableMethod, method, errMsg) \
     sol::object SharedTable:: tableMethod(sol::this_state state, \
             const sol::stack_object& leftObject, const sol::stack_object& rightObject) { \
-        return basicBinaryMetaMethod(methodName, errMsg, state, leftObject, rightObject); \
+        return basicBinaryMetaMethod(method, errMsg, state, leftObject, rightObject); \
     }
 
 namespace {
@@ -149,43 +414,47 @@ const std::string COMPARE_ERR_MSG = "attempt to compare a effil::table value";
 const std::string CONCAT_ERR_MSG = "attempt to concatenate a effil::table value";
 }
 
-sol::object SharedTable::basicBinaryMetaMethod(const std::string& metamethodName, const std::string& errMsg,
+StoredObject SharedTable::getMetamethod(Metamethod method) const {
+    const auto lock = lockForRead(*ctx_, ctx_->lock);
+    if (ctx_->metatable == GCNull)
+        return nullptr;
+    // Metatable is referenced by this table, so it stays alive while the lock is held
+    return static_cast<SharedTableData*>(ctx_->metatable)->metamethod(method);
+}
+
+sol::object SharedTable::basicBinaryMetaMethod(Metamethod method, const std::string& errMsg,
             sol::this_state state, const sol::stack_object& leftObject, const sol::stack_object& rightObject) {
     if (isSharedTable(leftObject)) {
         SharedTable table = leftObject.as<SharedTable>();
-        auto ctx_ = table.ctx_;
-        DEFFINE_METAMETHOD_CALL(metamethodName, table, rightObject)
+        DEFFINE_METAMETHOD_CALL(table, method, table, rightObject)
     }
     if (isSharedTable(rightObject)) {
         SharedTable table = rightObject.as<SharedTable>();
-        auto ctx_ = table.ctx_;
-        DEFFINE_METAMETHOD_CALL(metamethodName, leftObject, table)
+        DEFFINE_METAMETHOD_CALL(table, method, leftObject, table)
     }
     throw Exception() << errMsg;
 }
 
-PROXY_METAMETHOD_IMPL(luaConcat, "__concat", CONCAT_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaAdd, "__add", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaSub, "__sub", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaMul, "__mul", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaDiv, "__div", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaMod, "__mod", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaPow, "__pow", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaLe, "__le", ARITHMETIC_ERR_MSG)
-PROXY_METAMETHOD_IMPL(luaLt, "__lt", ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaConcat, Metamethod::Concat, CONCAT_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaAdd, Metamethod::Add, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaSub, Metamethod::Sub, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaMul, Metamethod::Mul, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaDiv, Metamethod::Div, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaMod, Metamethod::Mod, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaPow, Metamethod::Pow, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaLe, Metamethod::Le, ARITHMETIC_ERR_MSG)
+PROXY_METAMETHOD_IMPL(luaLt, Metamethod::Lt, ARITHMETIC_ERR_MSG)
 
 sol::object SharedTable::luaEq(sol::this_state state, const sol::stack_object& leftObject,
                                const sol::stack_object& rightObject) {
     if (isSharedTable(leftObject) && isSharedTable(rightObject)) {
         {
             SharedTable table = leftObject.as<SharedTable>();
-            auto ctx_ = table.ctx_;
-            DEFFINE_METAMETHOD_CALL("__eq", table, rightObject)
+            DEFFINE_METAMETHOD_CALL(table, Metamethod::Eq, table, rightObject)
         }
         {
             SharedTable table = rightObject.as<SharedTable>();
-            auto ctx_ = table.ctx_;
-            DEFFINE_METAMETHOD_CALL("__eq", leftObject, table)
+            DEFFINE_METAMETHOD_CALL(table, Metamethod::Eq, leftObject, table)
         }
         const bool isEqual = leftObject.as<SharedTable>().handle() == rightObject.as<SharedTable>().handle();
         return sol::make_object(state, isEqual);
@@ -194,22 +463,15 @@ sol::object SharedTable::luaEq(sol::this_state state, const sol::stack_object& l
 }
 
 sol::object SharedTable::luaUnm(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__unm")
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Unm)
     throw Exception() << ARITHMETIC_ERR_MSG;
 }
 
 void SharedTable::luaNewIndex(const sol::stack_object& luaKey, const sol::stack_object& luaValue, sol::this_state state) {
-    {
-        SharedLock lock(ctx_->lock);
-        if (ctx_->metatable != GCNull) {
-            auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable);
-            lock.unlock();
-            sol::function handler = tableHolder.get(createStoredObject("__newindex"), state);
-            if (handler.valid()) {
-                handler(*this, luaKey, luaValue);
-                return;
-            }
-        }
+    if (const StoredObject handler = getMetamethod(Metamethod::NewIndex)) {
+        sol::function func = handler.unpack(state);
+        func(*this, luaKey, luaValue);
+        return;
     }
     try {
         rawSet(luaKey, luaValue);
@@ -219,117 +481,169 @@ void SharedTable::luaNewIndex(const sol::stack_object& luaKey, const sol::stack_
 sol::object SharedTable::luaIndex(const sol::stack_object& luaKey, sol::this_state state) const {
     REQUIRE(luaKey.valid()) << "Indexing by nil";
     try {
-        StoredObject key = createStoredObject(luaKey);
-        if (sol::object result = get(key, state)) {
+        sol::object result = withStoredKeyView(luaKey, [&](const StoredKeyView& key) { return get(key, state); });
+        if (result) {
             return result;
         }
     } RETHROW_WITH_PREFIX("effil.table");
 
-    SharedLock lock(ctx_->lock);
-    if (ctx_->metatable != GCNull) {
-        const auto tableHolder = GC::instance().get<SharedTable>(ctx_->metatable);
-        lock.unlock();
-
-        SharedLock mt_lock(tableHolder.ctx_->lock);
-        const auto iter = tableHolder.ctx_->entries.find(createStoredObject("__index"));
-        if (iter != tableHolder.ctx_->entries.end()) {
-            if (const auto tbl = storedObjectTo<SharedTable>(iter->second)) {
-                mt_lock.unlock();
-                return tbl->luaIndex(luaKey, state);
-            }
-            else if (const auto func = storedObjectTo<Function>(iter->second)) {
-                mt_lock.unlock();
-                return func->loadFunction(state).as<sol::function>()(*this, luaKey);
-            }
-        }
+    if (const StoredObject handler = getMetamethod(Metamethod::Index)) {
+        if (const auto tbl = storedObjectTo<SharedTable>(handler))
+            return tbl->luaIndex(luaKey, state);
+        else if (const auto func = storedObjectTo<Function>(handler))
+            return func->loadFunction(state).as<sol::function>()(*this, luaKey);
     }
     return sol::nil;
 }
 
 StoredArray SharedTable::luaCall(sol::this_state state, const sol::variadic_args& args) {
-    SharedLock lock(ctx_->lock);
-    if (ctx_->metatable != GCNull) {
-        auto metatable = GC::instance().get<SharedTable>(ctx_->metatable);
-        sol::function handler = metatable.get(createStoredObject(std::string("__call")), state);
-        lock.unlock();
-        if (handler.valid()) {
-            StoredArray storedResults;
-            const int savedStackTop = lua_gettop(state);
-            sol::function_result callResults = handler(*this, args);
-            (void)callResults;
-            sol::variadic_args funcReturns(state, savedStackTop - lua_gettop(state));
-            for (const auto& param : funcReturns)
-                storedResults.emplace_back(createStoredObject(param.get<sol::object>()));
-            return storedResults;
-        }
+    if (const StoredObject handler = getMetamethod(Metamethod::Call)) {
+        sol::function func = handler.unpack(state);
+        StoredArray storedResults;
+        const int savedStackTop = lua_gettop(state);
+        sol::function_result callResults = func(*this, args);
+        (void)callResults;
+        sol::variadic_args funcReturns(state, savedStackTop - lua_gettop(state));
+        for (const auto& param : funcReturns)
+            storedResults.emplace_back(createStoredObject(param.get<sol::object>()));
+        return storedResults;
     }
     throw Exception() << "attempt to call a table";
 }
 
 sol::object SharedTable::luaToString(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__tostring");
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::ToString)
     std::stringstream ss;
     ss << "effil.table: " << ctx_.get();
     return sol::make_object(state, ss.str());
 }
 
 sol::object SharedTable::luaLength(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__len");
-    SharedLock g(ctx_->lock);
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Length)
+    return sol::make_object(state, length());
+}
+
+size_t SharedTable::length() const {
+    if (ctx_->shardsCount == 1) {
+        const auto g = lockForRead(*ctx_, ctx_->shards[0].lock);
+        return ctx_->shards[0].entries.length();
+    }
+
+    // Integer keys are spread between shards, so the only way is to check them one by one
     size_t len = 0u;
-    sol::optional<LUA_INDEX_TYPE> value;
-    auto iter = ctx_->entries.find(createStoredObject(static_cast<LUA_INDEX_TYPE>(1)));
-    if (iter != ctx_->entries.end()) {
-        do {
-            ++len;
-            ++iter;
-        } while ((iter != ctx_->entries.end()) && (value = storedObjectToIndexType(iter->first)) &&
-                 (static_cast<size_t>(value.value()) == len + 1));
+    while (true) {
+        const StoredObject key = createStoredObject(static_cast<LUA_INDEX_TYPE>(len + 1));
+        auto& shard = ctx_->shard(key);
+        const auto g = lockForRead(*ctx_, shard.lock);
+        if (shard.entries.find(key) == nullptr)
+            return len;
+        ++len;
     }
-    return sol::make_object(state, len);
 }
 
 SharedTable::PairsIterator SharedTable::getNext(const sol::object& key, sol::this_state lua) const {
-    SharedLock g(ctx_->lock);
+    size_t shardIdx = 0;
+    size_t pos = TableStorage::npos;
     if (key) {
-        auto obj = createStoredObject(key);
-        auto upper = ctx_->entries.upper_bound(obj);
-        if (upper != ctx_->entries.end())
-            return PairsIterator(upper->first->unpack(lua), upper->second->unpack(lua));
-    } else {
-        if (!ctx_->entries.empty()) {
-            const auto& begin = ctx_->entries.begin();
-            return PairsIterator(begin->first->unpack(lua), begin->second->unpack(lua));
+        const StoredObject storedKey = createStoredObject(key);
+        auto& shard = ctx_->shard(storedKey);
+        shardIdx = static_cast<size_t>(&shard - ctx_->shards.get());
+
+        const auto g = lockForRead(*ctx_, shard.lock);
+        pos = shard.entries.next(storedKey);
+        if (pos != TableStorage::npos)
+            return PairsIterator(shard.entries.keyAt(pos).unpack(lua), shard.entries.valueAt(pos).unpack(lua));
+        ++shardIdx;
+    }
+
+    for (; shardIdx < ctx_->shardsCount; ++shardIdx) {
+        auto& shard = ctx_->shards[shardIdx];
+        const auto g = lockForRead(*ctx_, shard.lock);
+        pos = shard.entries.first();
+        if (pos != TableStorage::npos)
+            return PairsIterator(shard.entries.keyAt(pos).unpack(lua), shard.entries.valueAt(pos).unpack(lua));
+    }
+    return PairsIterator(sol::nil, sol::nil);
+}
+
+// Cursor keeps position in the shard, so each step doesn't have to look up the previous key.
+// Position is valid until the shard is modified, after that cursor continues from the key.
+struct SharedTable::Cursor {
+    SharedTable table;
+    size_t shard;
+    size_t position; // npos if iteration over the shard hasn't been started
+    uint64_t version;
+    StoredObject key; // nullptr for positions of the array part
+};
+
+SharedTable::PairsIterator SharedTable::cursorNext(sol::this_state lua, Cursor& cursor, const sol::stack_object&) {
+    const auto& ctx = cursor.table.ctx_;
+    for (; cursor.shard < ctx->shardsCount; ++cursor.shard) {
+        auto& shard = ctx->shards[cursor.shard];
+        const auto g = lockForRead(*ctx, shard.lock);
+
+        const auto& entries = shard.entries;
+        const uint64_t version = shard.version.load(std::memory_order_relaxed);
+        size_t pos;
+        if (cursor.position == TableStorage::npos)
+            pos = entries.first();
+        else if (cursor.version == version)
+            pos = entries.next(cursor.position);
+        else if (cursor.key)
+            pos = entries.next(cursor.key);
+        else
+            pos = entries.next(createStoredObject(static_cast<LUA_INDEX_TYPE>(cursor.position + 1)));
+
+        if (pos != TableStorage::npos) {
+            cursor.position = pos;
+            cursor.version = version;
+            if (entries.isArrayPosition(pos)) {
+                cursor.key = nullptr;
+                return PairsIterator(sol::make_object(lua, static_cast<LUA_INDEX_TYPE>(pos + 1)),
+                                     entries.valueAt(pos).unpack(lua));
+            }
+            cursor.key = entries.keyAt(pos);
+            return PairsIterator(cursor.key.unpack(lua), entries.valueAt(pos).unpack(lua));
         }
+        cursor.position = TableStorage::npos;
+        cursor.key = nullptr;
     }
     return PairsIterator(sol::nil, sol::nil);
 }
 
 SharedTable::PairsIterator SharedTable::luaPairs(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__pairs");
-    auto next = [](sol::this_state state, SharedTable table, sol::stack_object key) { return table.getNext(key, state); };
-    return PairsIterator(
-        sol::make_object(state, std::function<PairsIterator(sol::this_state state, SharedTable table, sol::stack_object key)>(next)).as<sol::function>(),
-        sol::make_object(state, *this));
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::Pairs)
+    return PairsIterator(sol::make_object(state, &SharedTable::cursorNext).as<sol::function>(),
+                         sol::make_object(state, Cursor{*this, 0, TableStorage::npos, 0, nullptr}));
 }
 
-std::pair<sol::object, sol::object> ipairsNext(sol::this_state lua, SharedTable table, const sol::optional<LUA_INDEX_TYPE>& key) {
-    size_t index = key ? key.value() + 1 : 1;
-    auto objKey = createStoredObject(static_cast<LUA_INDEX_TYPE>(index));
-    sol::object value = table.get(objKey, lua);
-    if (!value.valid())
-        return std::pair<sol::object, sol::object>(sol::nil, sol::nil);
-    return std::pair<sol::object, sol::object>(objKey->unpack(lua), value);
+SharedTable::PairsIterator SharedTable::ipairsNext(sol::this_state lua, SharedTable table, const sol::optional<LUA_INDEX_TYPE>& key) {
+    const size_t index = key ? static_cast<size_t>(key.value()) + 1 : 1;
+
+    if (table.ctx_->shardsCount != 1) {
+        sol::object value = table.get(createStoredObject(static_cast<LUA_INDEX_TYPE>(index)), lua);
+        if (!value.valid())
+            return PairsIterator(sol::nil, sol::nil);
+        return PairsIterator(sol::make_object(lua, static_cast<LUA_INDEX_TYPE>(index)), value);
+    }
+
+    auto& shard = table.ctx_->shards[0];
+    const auto g = lockForRead(*table.ctx_, shard.lock);
+    const StoredObject* value = shard.entries.findIndex(index);
+    if (value == nullptr)
+        return PairsIterator(sol::nil, sol::nil);
+    return PairsIterator(sol::make_object(lua, static_cast<LUA_INDEX_TYPE>(index)), value->unpack(lua));
 }
 
 SharedTable::PairsIterator SharedTable::luaIPairs(sol::this_state state) {
-    DEFFINE_METAMETHOD_CALL_0("__ipairs");
-    return PairsIterator(sol::make_object(state, ipairsNext).as<sol::function>(),
+    DEFFINE_METAMETHOD_CALL_0(Metamethod::IPairs)
+    return PairsIterator(sol::make_object(state, &SharedTable::ipairsNext).as<sol::function>(),
                 sol::make_object(state, *this));
 }
 
 SharedTable SharedTable::setMetatable(const sol::optional<SharedTable>& metaTable) {
     UniqueLock lock(ctx_->lock);
+    checkNotFrozen();
     if (ctx_->metatable != GCNull) {
         ctx_->removeReference(ctx_->metatable);
         ctx_->metatable = GCNull;
@@ -355,10 +669,10 @@ SharedTable SharedTable::luaSetMetatable(const sol::stack_object& tbl, const sol
         << luaTypename(mt) << ")";
 
     SolTableToShared cache;
-    SharedTable table = GC::instance().get<SharedTable>(createStoredObject(tbl, cache)->gcHandle());
+    SharedTable table = GC::instance().get<SharedTable>(createStoredObject(tbl, cache).gcHandle());
     sol::optional<SharedTable> metatable;
     if (mt.valid()) {
-        metatable = GC::instance().get<SharedTable>(createStoredObject(mt, cache)->gcHandle());
+        metatable = GC::instance().get<SharedTable>(createStoredObject(mt, cache).gcHandle());
     }
     return table.setMetatable(metatable);
 }
@@ -367,7 +681,7 @@ sol::object SharedTable::luaGetMetatable(const sol::stack_object& tbl, sol::this
     REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.getmetatable' (effil.table expected, got " << luaTypename(tbl) << ")";
     auto& stable = tbl.as<SharedTable>();
 
-    SharedLock lock(stable.ctx_->lock);
+    const auto lock = lockForRead(*stable.ctx_, stable.ctx_->lock);
     return stable.ctx_->metatable == GCNull ? sol::nil :
             sol::make_object(state, GC::instance().get<SharedTable>(stable.ctx_->metatable));
 }
@@ -392,11 +706,362 @@ size_t SharedTable::luaSize(const sol::stack_object& tbl) {
     REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.size' (effil.table expected, got " << luaTypename(tbl) << ")";
     try {
         auto& stable = tbl.as<SharedTable>();
-        SharedLock g(stable.ctx_->lock);
-        return stable.ctx_->entries.size();
+        size_t size = 0;
+        for (size_t i = 0; i < stable.ctx_->shardsCount; ++i) {
+            auto& shard = stable.ctx_->shards[i];
+            const auto g = lockForRead(*stable.ctx_, shard.lock);
+            size += shard.entries.size();
+        }
+        return size;
     } RETHROW_WITH_PREFIX("effil.size");
 }
 
+SharedTable SharedTable::luaSetMany(const sol::stack_object& tbl, const sol::stack_object& values) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.set_many' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(values.get_type() == sol::type::table) << "bad argument #2 to 'effil.set_many' (table expected, got " << luaTypename(values) << ")";
+    try {
+        auto& stable = tbl.as<SharedTable>();
+
+        // Conversion may create nested shared tables, so it's done before locking
+        StoredEntries entries;
+        SolTableToShared visited;
+        for (const auto& row : values.as<sol::table>())
+            entries.emplace_back(createStoredObject(row.first, visited), createStoredObject(row.second, visited));
+
+        stable.setMany(StoredArray(), std::move(entries));
+        return stable;
+    } RETHROW_WITH_PREFIX("effil.set_many");
+}
+
+sol::object SharedTable::luaGetMany(const sol::stack_object& tbl, const sol::stack_object& keys, sol::this_state state) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.get_many' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(keys.get_type() == sol::type::table) << "bad argument #2 to 'effil.get_many' (table expected, got " << luaTypename(keys) << ")";
+    try {
+        auto& stable = tbl.as<SharedTable>();
+
+        std::vector<std::pair<sol::object, StoredObject>> storedKeys;
+        for (const auto& row : keys.as<sol::table>())
+            storedKeys.emplace_back(row.second, createStoredObject(row.second));
+
+        auto result = sol::table::create(state.L, 0, static_cast<int>(storedKeys.size()));
+        const auto locks = lockShardsForRead(*stable.ctx_);
+        for (const auto& key : storedKeys) {
+            const auto& shard = stable.ctx_->shard(key.second);
+            if (const StoredObject* value = shard.entries.find(key.second))
+                result.set(key.first, value->unpack(state));
+        }
+        return result;
+    } RETHROW_WITH_PREFIX("effil.get_many");
+}
+
+namespace {
+
+// Optimistic attempts of effil.update may conflict with other writers forever
+constexpr size_t MAXIMUM_UPDATE_ATTEMPTS = 16;
+
+// Values read from the table are stored back only if the update changed them
+bool isSameLuaValue(lua_State* state, const sol::object& left, const sol::object& right) {
+    if (left.get_type() != right.get_type())
+        return false;
+    sol::stack::push(state, left);
+    sol::stack::push(state, right);
+    bool same = lua_rawequal(state, -2, -1) != 0;
+#if LUA_VERSION_NUM == 503
+    same = same && lua_isinteger(state, -2) == lua_isinteger(state, -1);
+#endif // Lua5.3
+    lua_pop(state, 2);
+    return same;
+}
+
+} // namespace
+
+// Function works with a copy of the table and its result is applied only if
+// the table wasn't modified in the meantime, otherwise the function is called again.
+// Lua code isn't called under the lock, so it's free to access the table,
+// except for the last attempt, which holds the table locked to guarantee progress.
+SharedTable SharedTable::luaUpdate(const sol::stack_object& tbl, const sol::stack_object& func, sol::this_state state) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.update' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(func.get_type() == sol::type::function) << "bad argument #2 to 'effil.update' (function expected, got " << luaTypename(func) << ")";
+
+    auto& stable = tbl.as<SharedTable>();
+    try {
+        stable.checkNotFrozen();
+    } RETHROW_WITH_PREFIX("effil.update");
+    auto& ctx = *stable.ctx_;
+    const auto modifier = func.as<sol::function>();
+    std::vector<uint64_t> versions(ctx.shardsCount);
+
+    for (size_t attempt = 1; ; ++attempt) {
+        std::vector<UniqueLock> exclusiveLocks;
+        if (attempt == MAXIMUM_UPDATE_ATTEMPTS)
+            exclusiveLocks = lockShards<UniqueLock>(ctx);
+
+        // The function modifies the copy, the original is kept to find out what was changed
+        auto copy = sol::table::create(state.L);
+        auto original = sol::table::create(state.L);
+        {
+            std::vector<SharedLock> locks;
+            if (exclusiveLocks.empty())
+                locks = lockShards<SharedLock>(ctx);
+            for (size_t i = 0; i < ctx.shardsCount; ++i) {
+                const auto& shard = ctx.shards[i];
+                versions[i] = shard.version.load(std::memory_order_relaxed);
+                for (size_t pos = shard.entries.first(); pos != TableStorage::npos; pos = shard.entries.next(pos)) {
+                    const sol::object key = shard.entries.keyAt(pos).unpack(state);
+                    const sol::object value = shard.entries.valueAt(pos).unpack(state);
+                    copy.set(key, value);
+                    original.set(key, value);
+                }
+            }
+        }
+
+        const sol::object returned = modifier(copy);
+        if (returned.get_type() == sol::type::table)
+            copy = returned.as<sol::table>();
+
+        StoredEntries changed;
+        StoredArray removed;
+        try {
+            SolTableToShared visited;
+            for (const auto& row : copy) {
+                if (!isSameLuaValue(state, original.get<sol::object>(row.first), row.second))
+                    changed.emplace_back(createStoredObject(row.first, visited), createStoredObject(row.second, visited));
+            }
+            for (const auto& row : original) {
+                if (copy.get<sol::object>(row.first).get_type() == sol::type::nil)
+                    removed.push_back(createStoredObject(row.first));
+            }
+        } RETHROW_WITH_PREFIX("effil.update");
+
+        if (exclusiveLocks.empty()) {
+            exclusiveLocks = lockShards<UniqueLock>(ctx);
+            bool modified = false;
+            for (size_t i = 0; i < ctx.shardsCount; ++i)
+                modified = modified || ctx.shards[i].version.load(std::memory_order_relaxed) != versions[i];
+            if (modified)
+                continue;
+        }
+
+        try {
+            // Table is frozen under the locks of all shards, so the update is applied entirely or not at all
+            stable.checkNotFrozen();
+            for (auto& entry : changed) {
+                auto& shard = ctx.shard(entry.first);
+                stable.setEntry(shard, std::move(entry.first), std::move(entry.second));
+            }
+            for (const auto& key : removed)
+                stable.removeEntry(ctx.shard(key), key);
+        } RETHROW_WITH_PREFIX("effil.update");
+        return stable;
+    }
+}
+
+sol::object SharedTable::luaAtomicAdd(const sol::stack_object& tbl, const sol::stack_object& luaKey,
+                                      const sol::stack_object& luaDelta, sol::this_state state) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.atomic_add' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(!luaDelta.valid() || luaDelta.get_type() == sol::type::number)
+        << "bad argument #3 to 'effil.atomic_add' (number or nil expected, got " << luaTypename(luaDelta) << ")";
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        auto& stable = tbl.as<SharedTable>();
+        StoredObject key = createStoredObject(luaKey);
+        StoredObject delta = luaDelta.valid() ? createStoredObject(luaDelta) : createStoredObject(static_cast<LUA_INDEX_TYPE>(1));
+
+        auto& shard = stable.ctx_->shard(key);
+        UniqueLock g(shard.lock);
+        StoredObject* value = shard.entries.find(key);
+        if (value == nullptr) {
+            // missing value is considered to be zero
+            const auto result = delta.unpack(state);
+            stable.setEntry(shard, std::move(key), std::move(delta));
+            return result;
+        }
+
+        stable.checkNotFrozen();
+        REQUIRE(addToStoredNumber(*value, delta)) << "attempt to perform arithmetic on a non-number value";
+        bumpVersion(shard);
+        stable.ctx_->notifyWaiters(key);
+        return value->unpack(state);
+    } RETHROW_WITH_PREFIX("effil.atomic_add");
+}
+
+namespace {
+
+// Numbers are compared by value like in Lua
+bool storedObjectsEqual(const StoredObject& left, const StoredObject& right) {
+    if (left.type() == right.type())
+        return left.equals(right);
+    const auto leftNumber = storedObjectToNumber(left);
+    const auto rightNumber = storedObjectToNumber(right);
+    return leftNumber && rightNumber && *leftNumber == *rightNumber;
+}
+
+} // namespace
+
+bool SharedTable::luaCompareAndSwap(const sol::stack_object& tbl, const sol::stack_object& luaKey,
+                                    const sol::stack_object& luaExpected, const sol::stack_object& luaDesired) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.compare_and_swap' (effil.table expected, got " << luaTypename(tbl) << ")";
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        auto& stable = tbl.as<SharedTable>();
+        StoredObject key = createStoredObject(luaKey);
+        const StoredObject expected = luaExpected.valid() ? createStoredObject(luaExpected) : nullptr;
+        StoredObject desired = luaDesired.valid() ? createStoredObject(luaDesired) : nullptr;
+
+        auto& shard = stable.ctx_->shard(key);
+        UniqueLock g(shard.lock);
+        const StoredObject* value = shard.entries.find(key);
+        if (value == nullptr ? static_cast<bool>(expected) : !expected || !storedObjectsEqual(*value, expected))
+            return false;
+
+        if (desired)
+            stable.setEntry(shard, std::move(key), std::move(desired));
+        else
+            stable.removeEntry(shard, key);
+        return true;
+    } RETHROW_WITH_PREFIX("effil.compare_and_swap");
+}
+
+sol::object SharedTable::luaExchange(const sol::stack_object& tbl, const sol::stack_object& luaKey,
+                                     const sol::stack_object& luaValue, sol::this_state state) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.exchange' (effil.table expected, got " << luaTypename(tbl) << ")";
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        auto& stable = tbl.as<SharedTable>();
+        StoredObject key = createStoredObject(luaKey);
+        StoredObject value = luaValue.valid() ? createStoredObject(luaValue) : nullptr;
+
+        auto& shard = stable.ctx_->shard(key);
+        UniqueLock g(shard.lock);
+        // old value is unpacked before removing of the reference, so it can't be collected
+        const StoredObject* oldValue = shard.entries.find(key);
+        sol::object result = sol::nil;
+        if (oldValue)
+            result = oldValue->unpack(state);
+        if (value)
+            stable.setEntry(shard, std::move(key), std::move(value));
+        else
+            stable.removeEntry(shard, key);
+        return result;
+    } RETHROW_WITH_PREFIX("effil.exchange");
+}
+
+void SharedTable::freeze(bool recursive) {
+    std::vector<SharedTable> nested;
+    {
+        // Metatable lock is always taken before locks of shards
+        UniqueLock lock(ctx_->lock);
+        const auto locks = lockShards<UniqueLock>(*ctx_);
+        if (ctx_->frozen.load(std::memory_order_relaxed))
+            return;
+
+        for (size_t i = 0; i < ctx_->shardsCount; ++i) {
+            auto& shard = ctx_->shards[i];
+            shard.entries.compact();
+            bumpVersion(shard);
+
+            if (recursive) {
+                const auto& entries = shard.entries;
+                for (size_t pos = entries.first(); pos != TableStorage::npos; pos = entries.next(pos)) {
+                    if (const auto tbl = storedObjectTo<SharedTable>(entries.valueAt(pos)))
+                        nested.push_back(*tbl);
+                    if (!entries.isArrayPosition(pos)) {
+                        if (const auto tbl = storedObjectTo<SharedTable>(entries.keyAt(pos)))
+                            nested.push_back(*tbl);
+                    }
+                }
+            }
+        }
+
+        if (recursive && ctx_->metatable != GCNull)
+            nested.push_back(GC::instance().get<SharedTable>(ctx_->metatable));
+        ctx_->frozen.store(true, std::memory_order_release);
+    }
+    // Frozen table is never modified, so waiters give up
+    ctx_->interruptWaiters();
+
+    // Cycles are broken by the check of frozen flag
+    for (auto& tbl : nested)
+        tbl.freeze(true);
+}
+
+SharedTable SharedTable::luaFreeze(const sol::stack_object& tbl, const sol::optional<bool>& recursive) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.freeze' (effil.table expected, got " << luaTypename(tbl) << ")";
+    auto& stable = tbl.as<SharedTable>();
+    stable.freeze(recursive.value_or(false));
+    return stable;
+}
+
+bool SharedTable::luaIsFrozen(const sol::stack_object& tbl) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.is_frozen' (effil.table expected, got " << luaTypename(tbl) << ")";
+    return tbl.as<SharedTable>().ctx_->frozen.load(std::memory_order_acquire);
+}
+
+bool SharedTable::wait(const StoredObject& key, const StoredObject& expected,
+                       const sol::optional<std::chrono::milliseconds>& timeout) {
+    TableWaiter waiter(TableStorage::hashOf(key));
+    {
+        std::lock_guard<std::mutex> g(ctx_->waitersLock);
+        ctx_->waiters.push_back(&waiter);
+        ctx_->waitersCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    ScopeGuard unregister([&] {
+        std::lock_guard<std::mutex> g(ctx_->waitersLock);
+        ctx_->waiters.erase(std::find(ctx_->waiters.begin(), ctx_->waiters.end(), &waiter));
+        ctx_->waitersCount.fetch_sub(1, std::memory_order_relaxed);
+    });
+
+    this_thread::ScopedSetInterruptable interruptable(&waiter);
+    Timer timer(timeout ? *timeout : std::chrono::milliseconds());
+    auto& shard = ctx_->shard(key);
+    while (true) {
+        {
+            const auto g = lockForRead(*ctx_, shard.lock);
+            const StoredObject* value = shard.entries.find(key);
+            if (expected && (value == nullptr || !storedObjectsEqual(*value, expected)))
+                return true;
+        }
+
+        std::unique_lock<std::mutex> lock(waiter.lock);
+        while (!waiter.notified) {
+            if (ctx_->frozen.load(std::memory_order_acquire))
+                return false;
+            if (timeout) {
+                if (timer.isFinished() || waiter.cv.wait_for(lock, timer.left()) == std::cv_status::timeout)
+                    return false;
+            }
+            else { // No time limit
+                waiter.cv.wait(lock);
+            }
+            this_thread::interruptionPoint();
+        }
+        waiter.notified = false;
+        if (!expected)
+            return true;
+    }
+}
+
+std::pair<bool, sol::object> SharedTable::luaWait(const sol::stack_object& tbl, const sol::stack_object& luaKey,
+                                                  const sol::stack_object& luaExpected,
+                                                  const sol::optional<int>& duration,
+                                                  const sol::optional<std::string>& period,
+                                                  sol::this_state state) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.wait' (effil.table expected, got " << luaTypename(tbl) << ")";
+    try {
+        REQUIRE(luaKey.valid()) << "Indexing by nil";
+        sol::optional<std::chrono::milliseconds> timeout;
+        if (duration)
+            timeout = fromLuaTime(*duration, period);
+
+        this_thread::interruptionPoint();
+        auto& stable = tbl.as<SharedTable>();
+        const StoredObject key = createStoredObject(luaKey);
+        const StoredObject expected = luaExpected.valid() ? createStoredObject(luaExpected) : nullptr;
+        const bool changed = stable.wait(key, expected, timeout);
+        return std::make_pair(changed, stable.get(key, state));
+    } RETHROW_WITH_PREFIX("effil.wait");
+}
+
 SharedTable::PairsIterator SharedTable::globalLuaPairs(sol::this_state state, const sol::stack_object& obj) {
     REQUIRE(isSharedTable(obj)) << "bad argument #1 to 'effil.pairs' (effil.table expected, got " << luaTypename(obj) << ")";
     auto& tbl = obj.as<SharedTable>();
@@ -415,6 +1080,160 @@ SharedTable::PairsIterator SharedTable::globalLuaNext(sol::this_state state, con
     return tbl.getNext(key, state);
 }
 
+bool RangeKeyLess::operator()(const StoredObject& left, const StoredObject& right) const {
+    const auto leftNumber = storedObjectToNumber(left);
+    const auto rightNumber = storedObjectToNumber(right);
+    if (!leftNumber || !rightNumber) {
+        if (leftNumber || rightNumber)
+            return static_cast<bool>(leftNumber);
+        return *storedObjectToStringPointer(left) < *storedObjectToStringPointer(right);
+    }
+    if (*leftNumber != *rightNumber)
+        return *leftNumber < *rightNumber;
+    // Big integers may be equal by value converted to lua_Number
+    if (left.type() != right.type())
+        return left.type() == StoredObject::Type::Number;
+    return left.type() == StoredObject::Type::Integer && left.toInteger() < right.toInteger();
+}
+
+namespace {
+
+// Numbers are compared like in Lua: integers exactly and the rest by value
+bool numberKeyLess(const StoredObject& left, const StoredObject& right) {
+    if (left.type() == StoredObject::Type::Integer && right.type() == StoredObject::Type::Integer)
+        return left.toInteger() < right.toInteger();
+    return *storedObjectToNumber(left) < *storedObjectToNumber(right);
+}
+
+// Shard should be locked exclusively
+void buildRangeIndex(SharedTableData::Shard& shard) {
+    const auto& entries = shard.entries;
+    for (size_t pos = entries.first(); pos != TableStorage::npos; pos = entries.next(pos)) {
+        StoredObject key = entries.keyAt(pos);
+        if (isRangeKey(key))
+            shard.rangeIndex.insert(std::move(key));
+    }
+    shard.rangeIndexed.store(true, std::memory_order_release);
+}
+
+} // namespace
+
+StoredEntries SharedTable::range(const StoredObject& low, const StoredObject& high, size_t limit,
+                                 std::vector<std::shared_ptr<GCData>>& pinned) const {
+    for (size_t i = 0; i < ctx_->shardsCount; ++i) {
+        auto& shard = ctx_->shards[i];
+        if (!shard.rangeIndexed.load(std::memory_order_acquire)) {
+            UniqueLock g(shard.lock);
+            if (!shard.rangeIndexed.load(std::memory_order_relaxed))
+                buildRangeIndex(shard);
+        }
+    }
+
+    // Numeric range starts from the smallest key equal to low by value: floats go first.
+    // Keys equal to bounds by value may still be out of range, if bounds are big integers.
+    const auto lowNumber = storedObjectToNumber(low);
+    const auto highNumber = storedObjectToNumber(high);
+    const StoredObject start = lowNumber ? StoredObject::number(*lowNumber) : low;
+    const auto isAfterRange = [&](const StoredObject& key) {
+        if (highNumber) {
+            const auto number = storedObjectToNumber(key);
+            return !number || *number > *highNumber;
+        }
+        return RangeKeyLess()(high, key);
+    };
+    const auto isInRange = [&](const StoredObject& key) {
+        if (lowNumber)
+            return !numberKeyLess(key, low) && !numberKeyLess(high, key);
+        return !RangeKeyLess()(key, low);
+    };
+
+    // Sorted keys of shards are merged, the smallest key is on the top of the heap
+    typedef std::pair<RangeIndex::const_iterator, const SharedTableData::Shard*> ShardPosition;
+    const auto greater = [](const ShardPosition& left, const ShardPosition& right) {
+        return RangeKeyLess()(*right.first, *left.first);
+    };
+    std::priority_queue<ShardPosition, std::vector<ShardPosition>, decltype(greater)> heap(greater);
+
+    StoredEntries result;
+    const auto locks = lockShardsForRead(*ctx_);
+    for (size_t i = 0; i < ctx_->shardsCount; ++i) {
+        const auto& shard = ctx_->shards[i];
+        const auto position = shard.rangeIndex.lower_bound(start);
+        if (position != shard.rangeIndex.end() && !isAfterRange(*position))
+            heap.emplace(position, &shard);
+    }
+    while (!heap.empty() && result.size() < limit) {
+        ShardPosition top = heap.top();
+        heap.pop();
+        const StoredObject& key = *top.first;
+        if (isInRange(key)) {
+            const StoredObject* value = top.second->entries.find(key);
+            assert(value != nullptr);
+            result.emplace_back(key, *value);
+        }
+        if (++top.first != top.second->rangeIndex.end() && !isAfterRange(*top.first))
+            heap.push(top);
+    }
+
+    // Returned objects should stay alive after the table is unlocked.
+    // Holders are shared with the table, so they aren't modified.
+    for (const auto& entry : result) {
+        if (entry.first.gcHandle() != GCNull)
+            pinned.push_back(GC::instance().data(entry.first.gcHandle()));
+        if (entry.second.gcHandle() != GCNull)
+            pinned.push_back(GC::instance().data(entry.second.gcHandle()));
+    }
+    return result;
+}
+
+struct SharedTable::RangeCursor {
+    StoredEntries entries;
+    std::vector<std::shared_ptr<GCData>> pinned;
+    size_t position;
+};
+
+SharedTable::PairsIterator SharedTable::rangeNext(sol::this_state lua, RangeCursor& cursor, const sol::stack_object&) {
+    if (cursor.position == cursor.entries.size())
+        return PairsIterator(sol::nil, sol::nil);
+    const auto& entry = cursor.entries[cursor.position++];
+    return PairsIterator(entry.first.unpack(lua), entry.second.unpack(lua));
+}
+
+SharedTable::PairsIterator SharedTable::luaRange(sol::this_state state, const sol::stack_object& tbl,
+                                                 const sol::stack_object& luaLow, const sol::stack_object& luaHigh,
+                                                 const sol::stack_object& luaLimit) {
+    REQUIRE(isSharedTable(tbl)) << "bad argument #1 to 'effil.range' (effil.table expected, got " << luaTypename(tbl) << ")";
+    REQUIRE(luaLow.valid() && (luaLow.get_type() == sol::type::number || luaLow.get_type() == sol::type::string))
+            << "bad argument #2 to 'effil.range' (number or string expected, got " << luaTypename(luaLow) << ")";
+    REQUIRE(luaHigh.valid() && luaHigh.get_type() == luaLow.get_type())
+            << "bad argument #3 to 'effil.range' (" << luaTypename(luaLow) << " expected, got " << luaTypename(luaHigh) << ")";
+    REQUIRE(!luaLimit.valid() || luaLimit.get_type() == sol::type::number)
+            << "bad argument #4 to 'effil.range' (number expected, got " << luaTypename(luaLimit) << ")";
+    try {
+        const StoredObject low = createStoredObject(luaLow);
+        const StoredObject high = createStoredObject(luaHigh);
+        if (luaLow.get_type() == sol::type::number) {
+            const lua_Number lowNumber = *storedObjectToNumber(low);
+            const lua_Number highNumber = *storedObjectToNumber(high);
+            REQUIRE(lowNumber == lowNumber && highNumber == highNumber) << "range bound is NaN";
+        }
+        size_t limit = std::numeric_limits<size_t>::max();
+        if (luaLimit.valid()) {
+            const lua_Number value = luaLimit.as<lua_Number>();
+            REQUIRE(value >= 0) << "invalid limit value = " << value;
+            if (value < static_cast<lua_Number>(limit))
+                limit = static_cast<size_t>(value);
+        }
+
+        auto& stable = tbl.as<SharedTable>();
+        RangeCursor cursor;
+        cursor.entries = stable.range(low, high, limit, cursor.pinned);
+        cursor.position = 0;
+        return PairsIterator(sol::make_object(state, &SharedTable::rangeNext).as<sol::function>(),
+                             sol::make_object(state, std::move(cursor)));
+    } RETHROW_WITH_PREFIX("effil.range");
+}
+
 
 #undef DEFFINE_METAMETHOD_CALL_0
 #undef DEFFINE_METAMETHOD_CALL
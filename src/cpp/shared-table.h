@@ -2,29 +2,136 @@
 
 #include "gc-data.h"
 #include "stored-object.h"
+#include "table-storage.h"
 #include "spin-mutex.h"
 #include "utils.h"
 #include "lua-helpers.h"
 #include "gc-object.h"
+#include "notifier.h"
 
 #include <sol.hpp>
 
-#include <map>
+#include <atomic>
 #include <memory>
+#include <set>
 
 namespace effil {
 
+enum class Metamethod {
+    Index,
+    NewIndex,
+    Call,
+    ToString,
+    Length,
+    Pairs,
+    IPairs,
+    Unm,
+    Eq,
+    Lt,
+    Le,
+    Concat,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Mod,
+    Pow,
+    Count
+};
+
+// Thread blocked in effil.wait until the key is modified.
+// Waiters are matched by the hash of the key.
+struct TableWaiter : public IInterruptable {
+    explicit TableWaiter(uint64_t keyHash) : hash(keyHash) {}
+
+    void notify() {
+        std::lock_guard<std::mutex> g(lock);
+        notified = true;
+        cv.notify_all();
+    }
+
+    void interrupt() final {
+        std::lock_guard<std::mutex> g(lock);
+        cv.notify_all();
+    }
+
+    const uint64_t hash;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool notified = false;
+};
+
+// Order of keys in the range index: numbers by value go before strings compared byte-wise.
+// Integer and float keys equal by value are different keys of the table, floats go first.
+struct RangeKeyLess {
+    bool operator()(const StoredObject& left, const StoredObject& right) const;
+};
+
+typedef std::set<StoredObject, RangeKeyLess, SlabAllocator<StoredObject>> RangeIndex;
 
 class SharedTableData : public GCData {
 public:
-    using DataEntries = std::map<StoredObject, StoredObject, StoredObjectLess>;
+    // Entries are distributed between independently locked shards by key hash.
+    // Ordinary tables consist of the only shard.
+    struct Shard {
+        SpinMutex lock;
+        TableStorage entries;
+        // Incremented on each modification of entries
+        std::atomic<uint64_t> version {0};
+        // Presence of metamethods stored in this shard tagged by the shard version
+        std::atomic<uint64_t> metamethods {static_cast<uint64_t>(-1)};
+        // Numeric and string keys in order for effil.range.
+        // Index is built by the first range scan and maintained by modifications afterwards.
+        RangeIndex rangeIndex;
+        std::atomic_bool rangeIndexed {false};
+        // keep locks of neighbour shards in different cache lines
+        char padding[64];
+    };
+
 public:
-    SpinMutex lock;
-    DataEntries entries;
+    SharedTableData() : shards(new Shard[1]), shardsCount(1) {}
+
+    Shard& shard(const StoredKeyView& key) {
+        if (shardsCount == 1)
+            return shards[0];
+        return shards[TableStorage::hashOf(key) % shardsCount];
+    }
+
+    Shard& shardByHash(uint64_t hash) {
+        if (shardsCount == 1)
+            return shards[0];
+        return shards[hash % shardsCount];
+    }
+
+    // Returns metamethod when this table is used as a metatable or nullptr
+    StoredObject metamethod(Metamethod method);
+
+    size_t memory() const override;
+
+    // Wakes threads waiting for modification of the key, shard of the key should be locked
+    void notifyWaiters(const StoredKeyView& key);
+    // Wakes all waiters to let them check the frozen flag
+    void interruptWaiters();
+
+public:
+    SpinMutex lock; // guards metatable
+    // Frozen table is never modified again
+    std::atomic_bool frozen {false};
     GCHandle metatable = GCNull;
+    std::unique_ptr<Shard[]> shards;
+    size_t shardsCount;
+
+    std::mutex waitersLock; // guards waiters
+    std::vector<TableWaiter*> waiters;
+    // Allows writers to skip the lookup of waiters
+    std::atomic<size_t> waitersCount {0};
 };
 
-class SharedTable : public GCObject<SharedTableData> {
+typedef std::vector<std::pair<StoredObject, StoredObject>> StoredEntries;
+
+constexpr size_t MAXIMUM_TABLE_SHARDS = 1024;
+
+class SharedTable : public GCObject<SharedTableData, GCObjectType::SharedTable> {
 private:
     typedef std::pair<sol::object, sol::object> PairsIterator;
 
@@ -32,11 +139,13 @@ public:
     static void exportAPI(sol::state_view& lua);
 
     void set(StoredObject&&, StoredObject&&);
+    // Sets values of sequence to keys 1..N and the rest of entries at once
+    void setMany(StoredArray&& sequence, StoredEntries&& entries);
     void rawSet(const sol::stack_object& luaKey, const sol::stack_object& luaValue);
-    sol::object get(const StoredObject& key, sol::this_state state) const;
+    sol::object get(const StoredKeyView& key, sol::this_state state) const;
     sol::object rawGet(const sol::stack_object& key, sol::this_state state) const;
     static sol::object basicBinaryMetaMethod(
-            const std::string&, const std::string&, sol::this_state,
+            Metamethod, const std::string&, sol::this_state,
             const sol::stack_object&, const sol::stack_object&);
     SharedTable setMetatable(const sol::optional<SharedTable>& metaTable);
 
@@ -68,17 +177,77 @@ public:
     static sol::object luaRawGet(const sol::stack_object& tbl, const sol::stack_object& key, sol::this_state state);
     static SharedTable luaRawSet(const sol::stack_object& tbl, const sol::stack_object& key, const sol::stack_object& value);
     static size_t luaSize(const sol::stack_object& tbl);
+    static SharedTable luaSetMany(const sol::stack_object& tbl, const sol::stack_object& values);
+    static sol::object luaGetMany(const sol::stack_object& tbl, const sol::stack_object& keys, sol::this_state state);
+    static SharedTable luaUpdate(const sol::stack_object& tbl, const sol::stack_object& func, sol::this_state state);
+    static sol::object luaAtomicAdd(const sol::stack_object& tbl, const sol::stack_object& key,
+                                    const sol::stack_object& delta, sol::this_state state);
+    static bool luaCompareAndSwap(const sol::stack_object& tbl, const sol::stack_object& key,
+                                  const sol::stack_object& expected, const sol::stack_object& desired);
+    static SharedTable luaFreeze(const sol::stack_object& tbl, const sol::optional<bool>& recursive);
+    static bool luaIsFrozen(const sol::stack_object& tbl);
+    static std::pair<bool, sol::object> luaWait(const sol::stack_object& tbl, const sol::stack_object& key,
+                                                const sol::stack_object& expected,
+                                                const sol::optional<int>& duration,
+                                                const sol::optional<std::string>& period,
+                                                sol::this_state state);
+    static sol::object luaExchange(const sol::stack_object& tbl, const sol::stack_object& key,
+                                   const sol::stack_object& value, sol::this_state state);
     static PairsIterator globalLuaPairs(sol::this_state state, const sol::stack_object& obj);
     static PairsIterator globalLuaIPairs(sol::this_state state, const sol::stack_object& obj);
     static PairsIterator globalLuaNext(sol::this_state state, const sol::stack_object& obj, const sol::stack_object& key);
+    static PairsIterator luaRange(sol::this_state state, const sol::stack_object& tbl,
+                                  const sol::stack_object& low, const sol::stack_object& high,
+                                  const sol::stack_object& limit);
 
 private:
+    void freeze(bool recursive);
+    void checkNotFrozen() const;
+    // Blocks until the key is modified or, if expected value is set, until the value differs from it
+    bool wait(const StoredObject& key, const StoredObject& expected,
+              const sol::optional<std::chrono::milliseconds>& timeout);
+
+    // Modification of entries, shard should be locked
+    void setEntry(SharedTableData::Shard& shard, StoredObject&& key, StoredObject&& value);
+    void removeEntry(SharedTableData::Shard& shard, const StoredObject& key);
+
+    StoredObject getMetamethod(Metamethod method) const;
     PairsIterator getNext(const sol::object& key, sol::this_state lua) const;
+    size_t length() const;
+
+    // Iteration state of pairs
+    struct Cursor;
+    static PairsIterator cursorNext(sol::this_state lua, Cursor& cursor, const sol::stack_object& key);
+    static PairsIterator ipairsNext(sol::this_state lua, SharedTable table, const sol::optional<LUA_INDEX_TYPE>& key);
+
+    // Entries with keys in [low, high] sorted by key, at most limit of them.
+    // Keys are looked up in range indices of shards, which are built on the first call.
+    // Returned entries share holders with the table, so effil objects among them
+    // are kept alive by pinned data.
+    StoredEntries range(const StoredObject& low, const StoredObject& high, size_t limit,
+                        std::vector<std::shared_ptr<GCData>>& pinned) const;
+    struct RangeCursor;
+    static PairsIterator rangeNext(sol::this_state lua, RangeCursor& cursor, const sol::stack_object& key);
+
+private:
+    // View of the table referenced by the table which is locked by the caller.
+    // Referenced table is alive at least until the lock is released, so GC lookup is not required.
+    static SharedTable fromHandle(GCHandle handle);
+    explicit SharedTable(std::shared_ptr<SharedTableData> ctx) : GCObject(std::move(ctx)) {}
+
+    // Dump creates Lua tables with size hints when they are met
+    // and fills them from the work stack, so deep tables don't consume C stack.
+    // Registry references of created tables are kept in the cache.
+    int createDumpTable(lua_State* state, BaseHolder::DumpCache& cache, std::vector<SharedTable>& pending) const;
+    void dumpEntries(lua_State* state, BaseHolder::DumpCache& cache, std::vector<SharedTable>& pending) const;
 
 private:
     SharedTable() = default;
     void initialize() {}
+    void initialize(size_t shards);
     friend class GC;
+    friend class SnapshotWriter;
+    friend class SnapshotReader;
 };
 
 } // effil
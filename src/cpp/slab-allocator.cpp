@@ -0,0 +1,270 @@
+#include "slab-allocator.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace effil {
+
+namespace {
+
+constexpr size_t GRANULARITY = 16;
+constexpr size_t MAX_BLOCK_SIZE = 512;
+constexpr size_t CLASSES_COUNT = MAX_BLOCK_SIZE / GRANULARITY;
+constexpr size_t SLAB_SIZE = 64 * 1024;
+// Blocks are moved between thread cache and shared pool by batches
+constexpr size_t BATCH_SIZE = 32;
+// Maximum number of free blocks of each class kept by thread
+constexpr size_t CACHE_LIMIT = 2 * BATCH_SIZE;
+// Thread publishes its counters after this number of allocations
+constexpr uint64_t STATS_PERIOD = 1024;
+
+size_t sizeClass(size_t size) {
+    return size == 0 ? 0 : (size - 1) / GRANULARITY;
+}
+
+size_t blockSize(size_t sizeClass) {
+    return (sizeClass + 1) * GRANULARITY;
+}
+
+// Free blocks are linked into batches, batches in the shared pool are linked by their first blocks
+struct FreeBlock {
+    FreeBlock* next;
+    FreeBlock* nextBatch;
+};
+
+static_assert(sizeof(FreeBlock) <= GRANULARITY, "free block doesn't fit into the smallest block");
+
+// Detaches up to count blocks from the head of list
+FreeBlock* detach(FreeBlock*& list, size_t count) {
+    FreeBlock* head = list;
+    FreeBlock* last = list;
+    for (size_t i = 1; i < count && last->next != nullptr; ++i)
+        last = last->next;
+    list = last->next;
+    last->next = nullptr;
+    return head;
+}
+
+class SharedPool {
+public:
+    // Returns linked list of BATCH_SIZE free blocks
+    FreeBlock* takeBatch(size_t sizeClass) {
+        SizeClass& cls = classes_[sizeClass];
+        std::lock_guard<std::mutex> lock(cls.lock);
+        refills_.fetch_add(1, std::memory_order_relaxed);
+
+        if (cls.batches != nullptr) {
+            FreeBlock* batch = cls.batches;
+            cls.batches = batch->nextBatch;
+            return batch;
+        }
+
+        FreeBlock* batch = nullptr;
+        for (size_t i = 0; i < BATCH_SIZE; ++i) {
+            FreeBlock* block = takeLoose(cls);
+            if (block == nullptr)
+                block = carve(cls, blockSize(sizeClass));
+            block->next = batch;
+            batch = block;
+        }
+        return batch;
+    }
+
+    // Batch must contain exactly BATCH_SIZE blocks
+    void putBatch(size_t sizeClass, FreeBlock* batch) noexcept {
+        SizeClass& cls = classes_[sizeClass];
+        std::lock_guard<std::mutex> lock(cls.lock);
+        batch->nextBatch = cls.batches;
+        cls.batches = batch;
+    }
+
+    // Single blocks are used by threads which have no cache
+    FreeBlock* takeBlock(size_t sizeClass) {
+        SizeClass& cls = classes_[sizeClass];
+        std::lock_guard<std::mutex> lock(cls.lock);
+        if (FreeBlock* block = takeLoose(cls))
+            return block;
+        if (cls.batches != nullptr) {
+            FreeBlock* block = cls.batches;
+            cls.batches = block->nextBatch;
+            cls.loose = block->next;
+            return block;
+        }
+        return carve(cls, blockSize(sizeClass));
+    }
+
+    void putBlock(size_t sizeClass, FreeBlock* block) noexcept {
+        SizeClass& cls = classes_[sizeClass];
+        std::lock_guard<std::mutex> lock(cls.lock);
+        block->next = cls.loose;
+        cls.loose = block;
+    }
+
+    void publish(SlabStats& stats) {
+        allocations_.fetch_add(stats.allocations, std::memory_order_relaxed);
+        hits_.fetch_add(stats.hits, std::memory_order_relaxed);
+        large_.fetch_add(stats.large, std::memory_order_relaxed);
+        stats = SlabStats();
+    }
+
+    SlabStats stats() const {
+        SlabStats result;
+        result.allocations = allocations_.load(std::memory_order_relaxed);
+        result.hits = hits_.load(std::memory_order_relaxed);
+        result.refills = refills_.load(std::memory_order_relaxed);
+        result.slabs = slabs_.load(std::memory_order_relaxed);
+        result.large = large_.load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    struct SizeClass {
+        std::mutex lock;
+        FreeBlock* batches = nullptr;
+        FreeBlock* loose = nullptr;
+        char* slabCursor = nullptr;
+        char* slabEnd = nullptr;
+    };
+
+    static FreeBlock* takeLoose(SizeClass& cls) {
+        FreeBlock* block = cls.loose;
+        if (block != nullptr)
+            cls.loose = block->next;
+        return block;
+    }
+
+    FreeBlock* carve(SizeClass& cls, size_t size) {
+        if (cls.slabCursor == cls.slabEnd) {
+            cls.slabCursor = static_cast<char*>(::operator new(SLAB_SIZE));
+            cls.slabEnd = cls.slabCursor + SLAB_SIZE / size * size;
+            slabs_.fetch_add(1, std::memory_order_relaxed);
+        }
+        FreeBlock* block = reinterpret_cast<FreeBlock*>(cls.slabCursor);
+        cls.slabCursor += size;
+        return block;
+    }
+
+    SizeClass classes_[CLASSES_COUNT];
+    std::atomic<uint64_t> allocations_ {0};
+    std::atomic<uint64_t> hits_ {0};
+    std::atomic<uint64_t> refills_ {0};
+    std::atomic<uint64_t> slabs_ {0};
+    std::atomic<uint64_t> large_ {0};
+};
+
+// Pool is never destroyed, because blocks may be released
+// by destructors of other static objects
+SharedPool& sharedPool() {
+    static SharedPool* instance = new SharedPool();
+    return *instance;
+}
+
+class ThreadCache {
+public:
+    ~ThreadCache() {
+        for (size_t cls = 0; cls < CLASSES_COUNT; ++cls) {
+            for (; counts_[cls] >= BATCH_SIZE; counts_[cls] -= BATCH_SIZE)
+                sharedPool().putBatch(cls, detach(lists_[cls], BATCH_SIZE));
+            // Batches are handed out as full ones, so the rest goes block by block
+            while (FreeBlock* block = lists_[cls]) {
+                lists_[cls] = block->next;
+                sharedPool().putBlock(cls, block);
+            }
+        }
+        sharedPool().publish(stats_);
+    }
+
+    void* allocate(size_t sizeClass) {
+        if (++stats_.allocations == STATS_PERIOD)
+            sharedPool().publish(stats_);
+
+        FreeBlock*& list = lists_[sizeClass];
+        if (list != nullptr) {
+            ++stats_.hits;
+        } else {
+            list = sharedPool().takeBatch(sizeClass);
+            counts_[sizeClass] = BATCH_SIZE;
+        }
+
+        FreeBlock* block = list;
+        list = block->next;
+        --counts_[sizeClass];
+        return block;
+    }
+
+    void deallocate(size_t sizeClass, void* block) noexcept {
+        FreeBlock*& list = lists_[sizeClass];
+        FreeBlock* freeBlock = static_cast<FreeBlock*>(block);
+        freeBlock->next = list;
+        list = freeBlock;
+        if (++counts_[sizeClass] > CACHE_LIMIT) {
+            sharedPool().putBatch(sizeClass, detach(list, BATCH_SIZE));
+            counts_[sizeClass] -= BATCH_SIZE;
+        }
+    }
+
+    void countLarge() { ++stats_.large; }
+
+private:
+    FreeBlock* lists_[CLASSES_COUNT] = {};
+    size_t counts_[CLASSES_COUNT] = {};
+    SlabStats stats_ = SlabStats();
+};
+
+// Cache is created on demand and destroyed on thread exit.
+// Blocks released later by destructors of other thread local objects go to the shared pool.
+thread_local ThreadCache* threadCache = nullptr;
+thread_local bool threadCacheDestroyed = false;
+
+struct ThreadCacheOwner {
+    ~ThreadCacheOwner() {
+        delete threadCache;
+        threadCache = nullptr;
+        threadCacheDestroyed = true;
+    }
+    ThreadCache* cache = nullptr;
+};
+
+thread_local ThreadCacheOwner threadCacheOwner;
+
+ThreadCache* getThreadCache() noexcept {
+    if (threadCache == nullptr && !threadCacheDestroyed) {
+        threadCache = new (std::nothrow) ThreadCache();
+        // touch owner, so its destructor is registered
+        threadCacheOwner.cache = threadCache;
+    }
+    return threadCache;
+}
+
+} // namespace
+
+void* slabAllocate(size_t size) {
+    ThreadCache* cache = getThreadCache();
+    if (size > MAX_BLOCK_SIZE) {
+        if (cache != nullptr)
+            cache->countLarge();
+        return ::operator new(size);
+    }
+    if (cache != nullptr)
+        return cache->allocate(sizeClass(size));
+    return sharedPool().takeBlock(sizeClass(size));
+}
+
+void slabDeallocate(void* block, size_t size) noexcept {
+    if (block == nullptr)
+        return;
+    if (size > MAX_BLOCK_SIZE) {
+        ::operator delete(block);
+        return;
+    }
+    if (ThreadCache* cache = getThreadCache())
+        cache->deallocate(sizeClass(size), block);
+    else
+        sharedPool().putBlock(sizeClass(size), static_cast<FreeBlock*>(block));
+}
+
+SlabStats slabStats() {
+    return sharedPool().stats();
+}
+
+} // effil
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+
+namespace effil {
+
+// Allocator of small blocks used by holders, interned strings and channel messages.
+// Blocks are grouped in size classes. Each thread keeps its own lists of free blocks,
+// so most of allocations don't touch any shared state. Free blocks move between
+// threads through the shared pool in batches. Memory of slabs is never returned
+// to the system, it's reused for new blocks.
+// Bigger blocks are served by global operator new.
+void* slabAllocate(size_t size);
+void slabDeallocate(void* block, size_t size) noexcept;
+
+struct SlabStats {
+    uint64_t allocations; // allocations of small blocks
+    uint64_t hits;        // allocations served by the thread cache
+    uint64_t refills;     // batches of blocks taken from the shared pool
+    uint64_t slabs;       // slabs requested from the system
+    uint64_t large;       // allocations which are too big for slabs
+};
+
+// Running threads publish their counters from time to time, so values are approximate
+SlabStats slabStats();
+
+// Allocator for standard containers
+template <typename T>
+class SlabAllocator {
+public:
+    typedef T value_type;
+
+    SlabAllocator() = default;
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U>&) noexcept {}
+
+    T* allocate(size_t count) {
+        if (count > std::numeric_limits<size_t>::max() / sizeof(T))
+            throw std::bad_alloc();
+        return static_cast<T*>(slabAllocate(count * sizeof(T)));
+    }
+
+    void deallocate(T* block, size_t count) noexcept {
+        slabDeallocate(block, count * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U>&) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const SlabAllocator<U>&) const noexcept { return false; }
+};
+
+} // effil
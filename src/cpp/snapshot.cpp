@@ -0,0 +1,680 @@
+#include "snapshot.h"
+#include "shared-table.h"
+#include "function.h"
+#include "array.h"
+#include "garbage-collector.h"
+#include "file-replacement.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace effil {
+
+namespace {
+
+typedef std::shared_lock<SpinMutex> SharedLock;
+
+// Snapshot layout:
+//   header: magic, format version, byte order marker, Lua version, sizes of numbers
+//   root value: reference to the root table
+//   records: kind, object id and contents of each referenced object
+//   end marker
+// Object is defined by its first reference, which carries the object kind
+// and the parameters required to create it. Strings are written once
+// and referenced by the number of their first occurrence later on.
+const char SNAPSHOT_MAGIC[8] = {'E', 'F', 'F', 'I', 'L', 'S', 'N', 'P'};
+constexpr uint32_t SNAPSHOT_VERSION = 1;
+constexpr uint32_t BYTE_ORDER_MARKER = 0x01020304;
+
+constexpr size_t BUFFER_SIZE = 1 << 20;
+constexpr size_t MAXIMUM_UPVALUES = 255;
+
+enum class ValueTag : uint8_t {
+    Empty,  // environment upvalue of functions
+    Nil,
+    False,
+    True,
+    Integer,
+    Number,
+    String,
+    StringRef,
+    Object,
+    ApiReference
+};
+
+enum class RecordKind : uint8_t {
+    End,
+    Table,
+    Function,
+    Array
+};
+
+class SnapshotOutput {
+public:
+    explicit SnapshotOutput(const std::string& path) : file_(path) {
+        buffer_.reserve(BUFFER_SIZE);
+    }
+
+    void write(const void* data, size_t size) {
+        if (buffer_.size() + size > BUFFER_SIZE)
+            flush();
+        const char* bytes = static_cast<const char*>(data);
+        if (size >= BUFFER_SIZE)
+            file_.write(bytes, size);
+        else
+            buffer_.insert(buffer_.end(), bytes, bytes + size);
+    }
+
+    template <typename T>
+    void raw(T value) { write(&value, sizeof(value)); }
+
+    template <typename Enum>
+    void tag(Enum value) { raw(static_cast<uint8_t>(value)); }
+
+    void varint(uint64_t value) {
+        uint8_t bytes[10];
+        size_t size = 0;
+        while (value >= 0x80) {
+            bytes[size++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        bytes[size++] = static_cast<uint8_t>(value);
+        write(bytes, size);
+    }
+
+    void string(const std::string& value) {
+        varint(value.size());
+        write(value.data(), value.size());
+    }
+
+    // Replaces the previous snapshot, incomplete snapshot never overwrites it
+    void commit() {
+        flush();
+        file_.commit();
+    }
+
+private:
+    void flush() {
+        file_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
+    }
+
+    FileReplacement file_;
+    std::vector<char> buffer_;
+};
+
+class SnapshotInput {
+public:
+    explicit SnapshotInput(const std::string& path)
+            : path_(path), file_(path, std::ios::binary) {
+        REQUIRE(file_.is_open()) << "unable to open '" << path << "' for reading";
+        file_.seekg(0, std::ios::end);
+        size_ = static_cast<uint64_t>(file_.tellg());
+        file_.seekg(0, std::ios::beg);
+        buffer_.resize(BUFFER_SIZE);
+    }
+
+    // Size of the file limits sizes read from the snapshot,
+    // so corrupted data doesn't lead to huge allocations
+    uint64_t size() const { return size_; }
+
+    void read(void* data, size_t size) {
+        char* bytes = static_cast<char*>(data);
+        while (size > 0) {
+            if (position_ == available_)
+                fill();
+            const size_t chunk = std::min(size, available_ - position_);
+            std::memcpy(bytes, buffer_.data() + position_, chunk);
+            position_ += chunk;
+            bytes += chunk;
+            size -= chunk;
+        }
+    }
+
+    template <typename T>
+    T raw() {
+        T value;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    uint8_t byte() { return raw<uint8_t>(); }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            const uint8_t byte = raw<uint8_t>();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0)
+                return value;
+        }
+        throw Exception() << "corrupted snapshot '" << path_ << "'";
+    }
+
+    uint64_t length() {
+        const uint64_t value = varint();
+        REQUIRE(value <= size_) << "corrupted snapshot '" << path_ << "'";
+        return value;
+    }
+
+    void string(std::string& value) {
+        value.resize(static_cast<size_t>(length()));
+        read(&value[0], value.size());
+    }
+
+    const std::string& path() const { return path_; }
+
+private:
+    void fill() {
+        file_.read(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+        available_ = static_cast<size_t>(file_.gcount());
+        position_ = 0;
+        REQUIRE(available_ > 0) << "unexpected end of snapshot '" << path_ << "'";
+    }
+
+    std::string path_;
+    std::ifstream file_;
+    uint64_t size_ = 0;
+    std::vector<char> buffer_;
+    size_t position_ = 0;
+    size_t available_ = 0;
+};
+
+// Integers are written as varints, zigzag keeps small negative numbers short
+uint64_t zigzagEncode(lua_Integer value) {
+    const auto bits = static_cast<uint64_t>(static_cast<int64_t>(value));
+    return (bits << 1) ^ (value < 0 ? ~uint64_t(0) : 0);
+}
+
+lua_Integer zigzagDecode(uint64_t value) {
+    return static_cast<lua_Integer>(static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1)));
+}
+
+const char* unsupportedTypeName(HolderType type) {
+    switch (type) {
+        case HolderType::CFunction: return "C function";
+        case HolderType::Channel: return "effil.channel";
+        case HolderType::Thread: return "effil.thread";
+        case HolderType::ThreadRunner: return "effil.thread runner";
+        case HolderType::MappedTable: return "effil.mmap_table";
+        case HolderType::Cache: return "effil.cache";
+        default: return "userdata";
+    }
+}
+
+} // namespace
+
+class SnapshotWriter {
+public:
+    explicit SnapshotWriter(const std::string& path) : output_(path) {}
+
+    void save(const SharedTable& root) {
+        writeHeader();
+        ids_.emplace(root.handle(), 0);
+        objects_.push_back({std::unique_ptr<BaseGCObject>(new SharedTable(root)), false});
+        writeReference(0);
+
+        // Objects met in records are appended to the queue
+        for (size_t id = 0; id < objects_.size(); ++id) {
+            const BaseGCObject& object = *objects_[id].view;
+            switch (object.type()) {
+                case GCObjectType::SharedTable:
+                    writeTable(id, static_cast<const SharedTable&>(object));
+                    break;
+                case GCObjectType::Function:
+                    writeFunction(id, static_cast<const Function&>(object));
+                    break;
+                case GCObjectType::Array:
+                    writeArray(id, static_cast<const Array&>(object));
+                    break;
+                default:
+                    assert(false);
+            }
+            // Views are not needed after their records are written
+            objects_[id].view.reset();
+        }
+        output_.tag(RecordKind::End);
+        output_.commit();
+    }
+
+private:
+    struct TrackedObject {
+        std::unique_ptr<BaseGCObject> view;
+        bool defined;
+    };
+
+    void writeHeader() {
+        output_.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        output_.raw(SNAPSHOT_VERSION);
+        output_.raw(BYTE_ORDER_MARKER);
+        output_.varint(LUA_VERSION_NUM);
+        output_.raw(static_cast<uint8_t>(sizeof(lua_Integer)));
+        output_.raw(static_cast<uint8_t>(sizeof(lua_Number)));
+    }
+
+    // Must be called while the object referencing value is locked
+    void track(const StoredObject& value) {
+        const GCHandle handle = value.gcHandle();
+        if (handle == GCNull || ids_.count(handle) != 0)
+            return;
+
+        BaseGCObject* view = nullptr;
+        switch (value.holder()->type()) {
+            case HolderType::SharedTable:
+                view = new SharedTable(SharedTable::fromHandle(handle));
+                break;
+            case HolderType::Function:
+                view = new Function(GC::instance().get<Function>(handle));
+                break;
+            case HolderType::Array:
+                view = new Array(GC::instance().get<Array>(handle));
+                break;
+            default:
+                // rejected when the value is written
+                return;
+        }
+        ids_.emplace(handle, objects_.size());
+        objects_.push_back({std::unique_ptr<BaseGCObject>(view), false});
+    }
+
+    void writeReference(size_t id) {
+        TrackedObject& object = objects_[id];
+        output_.tag(ValueTag::Object);
+        output_.varint(id);
+        if (object.defined)
+            return;
+
+        object.defined = true;
+        switch (object.view->type()) {
+            case GCObjectType::SharedTable:
+                output_.tag(RecordKind::Table);
+                output_.varint(static_cast<const SharedTable&>(*object.view).ctx_->shardsCount);
+                break;
+            case GCObjectType::Function:
+                output_.tag(RecordKind::Function);
+                break;
+            case GCObjectType::Array: {
+                const auto& data = *static_cast<const Array&>(*object.view).ctx_;
+                output_.tag(RecordKind::Array);
+                output_.tag(data.type);
+                output_.varint(data.size);
+                break;
+            }
+            default:
+                assert(false);
+        }
+    }
+
+    void writeValue(const StoredObject& value) {
+        switch (value.type()) {
+            case StoredObject::Type::Empty:
+                output_.tag(ValueTag::Empty);
+                return;
+            case StoredObject::Type::Nil:
+                output_.tag(ValueTag::Nil);
+                return;
+            case StoredObject::Type::Boolean:
+                output_.tag(value.toBoolean() ? ValueTag::True : ValueTag::False);
+                return;
+            case StoredObject::Type::Integer:
+                output_.tag(ValueTag::Integer);
+                output_.varint(zigzagEncode(value.toInteger()));
+                return;
+            case StoredObject::Type::Number:
+                output_.tag(ValueTag::Number);
+                output_.raw(value.toNumber());
+                return;
+            case StoredObject::Type::LightUserdata:
+                throw Exception() << "unable to save light userdata";
+            case StoredObject::Type::Holder:
+                break;
+        }
+
+        const HolderType type = value.holder()->type();
+        switch (type) {
+            case HolderType::String:
+                writeString(*storedObjectToString(value));
+                return;
+            case HolderType::SharedTable:
+            case HolderType::Function:
+            case HolderType::Array:
+                writeReference(ids_.at(value.gcHandle()));
+                return;
+            case HolderType::ApiReference:
+                output_.tag(ValueTag::ApiReference);
+                return;
+            default:
+                throw Exception() << "unable to save " << unsupportedTypeName(type);
+        }
+    }
+
+    void writeString(std::string value) {
+        const auto iter = strings_.find(value);
+        if (iter != strings_.end()) {
+            output_.tag(ValueTag::StringRef);
+            output_.varint(iter->second);
+            return;
+        }
+        output_.tag(ValueTag::String);
+        output_.string(value);
+        strings_.emplace(std::move(value), strings_.size());
+    }
+
+    void writeTable(size_t id, const SharedTable& table) {
+        const auto& data = *table.ctx_;
+
+        // Entries are copied under the lock of the shard and written after that,
+        // so the file is never written while the table is locked
+        StoredEntries entries;
+        for (size_t i = 0; i < data.shardsCount; ++i) {
+            const auto& shard = data.shards[i];
+            SharedLock lock(shard.lock);
+            const auto& storage = shard.entries;
+            entries.reserve(entries.size() + storage.size());
+            for (size_t pos = storage.first(); pos != TableStorage::npos; pos = storage.next(pos)) {
+                entries.emplace_back(storage.keyAt(pos), storage.valueAt(pos));
+                track(entries.back().first);
+                track(entries.back().second);
+            }
+        }
+
+        StoredObject metatable;
+        {
+            SharedLock lock(data.lock);
+            if (data.metatable != GCNull) {
+                metatable = createStoredObject(SharedTable::fromHandle(data.metatable));
+                track(metatable);
+            }
+        }
+
+        output_.tag(RecordKind::Table);
+        output_.varint(id);
+        output_.raw(static_cast<uint8_t>(data.frozen.load(std::memory_order_acquire)));
+        if (metatable)
+            writeValue(metatable);
+        else
+            output_.tag(ValueTag::Nil);
+        output_.varint(entries.size());
+        for (const auto& entry : entries) {
+            writeValue(entry.first);
+            writeValue(entry.second);
+        }
+    }
+
+    void writeFunction(size_t id, const Function& function) {
+        // Functions are never modified after creation
+        const auto& data = *function.ctx_;
+        for (const auto& upvalue : data.upvalues)
+            track(upvalue);
+
+        output_.tag(RecordKind::Function);
+        output_.varint(id);
+        output_.string(data.function);
+#if LUA_VERSION_NUM > 501
+        output_.raw(data.envUpvaluePos);
+#else
+        output_.raw(uint8_t(0));
+#endif // LUA_VERSION_NUM > 501
+        output_.varint(data.upvalues.size());
+        for (const auto& upvalue : data.upvalues)
+            writeValue(upvalue);
+    }
+
+    void writeArray(size_t id, const Array& array) {
+        auto& data = *array.ctx_;
+        output_.tag(RecordKind::Array);
+        output_.varint(id);
+
+        SharedLock lock(data.lock);
+        output_.write(data.buffer.get(), data.size * arrayElementSize(data.type));
+    }
+
+private:
+    SnapshotOutput output_;
+    std::unordered_map<GCHandle, size_t> ids_;
+    std::vector<TrackedObject> objects_;
+    std::unordered_map<std::string, uint64_t> strings_;
+};
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& path) : input_(path) {}
+
+    SharedTable load() {
+        readHeader();
+        const StoredObject root = readValue();
+        require(root.holder() != nullptr && root.holder()->type() == HolderType::SharedTable);
+
+        for (;;) {
+            const auto kind = static_cast<RecordKind>(input_.byte());
+            if (kind == RecordKind::End)
+                break;
+
+            const auto iter = objects_.find(input_.varint());
+            require(iter != objects_.end() && !iter->second.filled);
+            BaseGCObject& object = *iter->second.view;
+            iter->second.filled = true;
+            ++filled_;
+
+            switch (kind) {
+                case RecordKind::Table:
+                    require(object.type() == GCObjectType::SharedTable);
+                    readTable(static_cast<SharedTable&>(object));
+                    break;
+                case RecordKind::Function:
+                    require(object.type() == GCObjectType::Function);
+                    readFunction(static_cast<Function&>(object));
+                    break;
+                case RecordKind::Array:
+                    require(object.type() == GCObjectType::Array);
+                    readArray(static_cast<Array&>(object));
+                    break;
+                default:
+                    require(false);
+            }
+        }
+        // Each referenced object has to be filled
+        require(filled_ == objects_.size());
+        return GC::instance().get<SharedTable>(root.gcHandle());
+    }
+
+private:
+    struct LoadedObject {
+        std::unique_ptr<BaseGCObject> view;
+        bool filled;
+    };
+
+    void require(bool condition) {
+        REQUIRE(condition) << "corrupted snapshot '" << input_.path() << "'";
+    }
+
+    void readHeader() {
+        char magic[sizeof(SNAPSHOT_MAGIC)];
+        REQUIRE(input_.size() >= sizeof(magic)) << "'" << input_.path() << "' is not a snapshot";
+        input_.read(magic, sizeof(magic));
+        REQUIRE(std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0)
+                << "'" << input_.path() << "' is not a snapshot";
+
+        const auto version = input_.raw<uint32_t>();
+        const auto byteOrder = input_.raw<uint32_t>();
+        REQUIRE(byteOrder == BYTE_ORDER_MARKER)
+                << "snapshot '" << input_.path() << "' is saved on incompatible platform";
+        REQUIRE(version == SNAPSHOT_VERSION) << "unsupported snapshot version " << version;
+        const uint64_t luaVersion = input_.varint();
+        const uint8_t integerSize = input_.byte();
+        const uint8_t numberSize = input_.byte();
+        REQUIRE(integerSize == sizeof(lua_Integer) && numberSize == sizeof(lua_Number))
+                << "snapshot '" << input_.path() << "' is saved on incompatible platform";
+        REQUIRE(luaVersion == LUA_VERSION_NUM)
+                << "snapshot '" << input_.path() << "' is saved by Lua " << luaVersion;
+    }
+
+    StoredObject readValue() {
+        switch (static_cast<ValueTag>(input_.byte())) {
+            case ValueTag::Empty:
+                return StoredObject();
+            case ValueTag::Nil:
+                return StoredObject::nil();
+            case ValueTag::False:
+                return StoredObject::boolean(false);
+            case ValueTag::True:
+                return StoredObject::boolean(true);
+            case ValueTag::Integer:
+                return StoredObject::integer(zigzagDecode(input_.varint()));
+            case ValueTag::Number:
+                return StoredObject::number(input_.raw<lua_Number>());
+            case ValueTag::String:
+                input_.string(buffer_);
+                strings_.push_back(createStoredObject(buffer_));
+                return strings_.back();
+            case ValueTag::StringRef: {
+                const uint64_t id = input_.varint();
+                require(id < strings_.size());
+                return strings_[id];
+            }
+            case ValueTag::Object:
+                return readObject();
+            case ValueTag::ApiReference:
+                return createStoredApiReference();
+        }
+        require(false);
+        return StoredObject();
+    }
+
+    StoredObject readObject() {
+        const uint64_t id = input_.varint();
+        auto iter = objects_.find(id);
+        if (iter == objects_.end()) {
+            // Views keep created objects alive until they are referenced by the root
+            iter = objects_.emplace(id, LoadedObject{createObject(), false}).first;
+        }
+
+        const BaseGCObject& object = *iter->second.view;
+        switch (object.type()) {
+            case GCObjectType::SharedTable:
+                return createStoredObject(static_cast<const SharedTable&>(object));
+            case GCObjectType::Function:
+                return createStoredObject(static_cast<const Function&>(object));
+            case GCObjectType::Array:
+                return createStoredObject(static_cast<const Array&>(object));
+            default:
+                assert(false);
+                return StoredObject();
+        }
+    }
+
+    std::unique_ptr<BaseGCObject> createObject() {
+        switch (static_cast<RecordKind>(input_.byte())) {
+            case RecordKind::Table: {
+                const uint64_t shards = input_.varint();
+                require(shards >= 1 && shards <= MAXIMUM_TABLE_SHARDS);
+                return std::unique_ptr<BaseGCObject>(
+                        new SharedTable(GC::instance().create<SharedTable>(static_cast<size_t>(shards))));
+            }
+            case RecordKind::Function:
+                return std::unique_ptr<BaseGCObject>(new Function(GC::instance().create<Function>()));
+            case RecordKind::Array: {
+                const uint8_t type = input_.byte();
+                require(type <= static_cast<uint8_t>(ArrayElementType::UInt8));
+                const auto elementType = static_cast<ArrayElementType>(type);
+                const uint64_t size = input_.varint();
+                require(size <= input_.size() / arrayElementSize(elementType));
+                return std::unique_ptr<BaseGCObject>(
+                        new Array(GC::instance().create<Array>(elementType, static_cast<size_t>(size))));
+            }
+            default:
+                require(false);
+                return nullptr;
+        }
+    }
+
+    void readTable(SharedTable& table) {
+        const bool frozen = input_.byte() != 0;
+        const StoredObject metatable = readValue();
+        const uint64_t count = input_.length();
+
+        StoredArray sequence;
+        StoredEntries entries;
+        for (uint64_t i = 0; i < count; ++i) {
+            StoredObject key = readValue();
+            StoredObject value = readValue();
+            require(key && key.type() != StoredObject::Type::Nil && value && value.type() != StoredObject::Type::Nil);
+            // Keys 1..N of the sequence are written first
+            if (entries.empty() && key.equals(createStoredObject(static_cast<LUA_INDEX_TYPE>(sequence.size() + 1))))
+                sequence.push_back(std::move(value));
+            else
+                entries.emplace_back(std::move(key), std::move(value));
+        }
+        table.setMany(std::move(sequence), std::move(entries));
+
+        if (metatable.type() != StoredObject::Type::Nil) {
+            require(metatable.holder() != nullptr && metatable.holder()->type() == HolderType::SharedTable);
+            table.setMetatable(GC::instance().get<SharedTable>(metatable.gcHandle()));
+        }
+        if (frozen)
+            table.freeze(false);
+    }
+
+    void readFunction(Function& function) {
+        auto& data = *function.ctx_;
+        input_.string(data.function);
+        const uint8_t envUpvaluePos = input_.byte();
+#if LUA_VERSION_NUM > 501
+        data.envUpvaluePos = envUpvaluePos;
+#else
+        require(envUpvaluePos == 0);
+#endif // LUA_VERSION_NUM > 501
+
+        const uint64_t count = input_.varint();
+        require(count <= MAXIMUM_UPVALUES && envUpvaluePos <= count);
+        data.upvalues.resize(static_cast<size_t>(count));
+        for (size_t i = 0; i < data.upvalues.size(); ++i) {
+            StoredObject value = readValue();
+            require(static_cast<bool>(value) == (i + 1 != envUpvaluePos));
+            if (value.gcHandle() != GCNull) {
+                data.addReference(value.gcHandle());
+                value.releaseStrongReference();
+            }
+            data.upvalues[i] = std::move(value);
+        }
+    }
+
+    void readArray(Array& array) {
+        auto& data = *array.ctx_;
+        input_.read(data.buffer.get(), data.size * arrayElementSize(data.type));
+    }
+
+private:
+    SnapshotInput input_;
+    std::unordered_map<uint64_t, LoadedObject> objects_;
+    size_t filled_ = 0;
+    std::vector<StoredObject> strings_;
+    std::string buffer_;
+};
+
+void luaSaveSnapshot(const sol::stack_object& table, const sol::stack_object& path) {
+    REQUIRE(table.valid() && table.is<SharedTable>())
+            << "bad argument #1 to 'effil.save' (effil.table expected, got " << luaTypename(table) << ")";
+    REQUIRE(path.valid() && path.get_type() == sol::type::string)
+            << "bad argument #2 to 'effil.save' (string expected, got " << luaTypename(path) << ")";
+    try {
+        SnapshotWriter writer(path.as<std::string>());
+        writer.save(table.as<SharedTable>());
+    } RETHROW_WITH_PREFIX("effil.save");
+}
+
+sol::object luaLoadSnapshot(const sol::stack_object& path, sol::this_state state) {
+    REQUIRE(path.valid() && path.get_type() == sol::type::string)
+            << "bad argument #1 to 'effil.load' (string expected, got " << luaTypename(path) << ")";
+    try {
+        SnapshotReader reader(path.as<std::string>());
+        return sol::make_object(state, reader.load());
+    } RETHROW_WITH_PREFIX("effil.load");
+}
+
+} // namespace effil
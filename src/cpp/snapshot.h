@@ -0,0 +1,15 @@
+#pragma once
+
+#include <sol.hpp>
+
+namespace effil {
+
+// Binary snapshots of shared tables.
+// Snapshot keeps the whole graph of tables reachable from the root one:
+// shared subtables, cycles, metatables, arrays and functions with upvalues.
+// Snapshot can be loaded only by the same Lua version on the platform
+// with the same byte order and size of numbers, because it contains Lua bytecode.
+void luaSaveSnapshot(const sol::stack_object& table, const sol::stack_object& path);
+sol::object luaLoadSnapshot(const sol::stack_object& path, sol::this_state state);
+
+} // namespace effil
@@ -0,0 +1,95 @@
+#include "spin-mutex.h"
+
+#include <chrono>
+
+namespace effil {
+
+namespace {
+
+constexpr size_t VISIBLE_READERS_BITS = 12;
+constexpr size_t VISIBLE_READERS_COUNT = 1 << VISIBLE_READERS_BITS;
+
+// Number of visible shared locks simultaneously held by one thread.
+// Nested locks above this limit go through the readers counter.
+constexpr size_t MAX_THREAD_VISIBLE_LOCKS = 4;
+
+// Bias stays disabled N times longer than the revocation took
+constexpr int64_t INHIBIT_MULTIPLIER = 9;
+
+std::atomic<const SpinMutex*> visibleReaders[VISIBLE_READERS_COUNT];
+
+struct ThreadVisibleLocks {
+    size_t count;
+    const SpinMutex* mutexes[MAX_THREAD_VISIBLE_LOCKS];
+    size_t slots[MAX_THREAD_VISIBLE_LOCKS];
+};
+
+// Zero initialized, address of this object is unique for each thread
+thread_local ThreadVisibleLocks threadLocks;
+
+size_t visibleReaderSlot(const SpinMutex* mutex) {
+    uint64_t hash = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&threadLocks)) * 0x9e3779b97f4a7c15ull;
+    hash ^= static_cast<uint64_t>(reinterpret_cast<uintptr_t>(mutex));
+    hash *= 0xbf58476d1ce4e5b9ull;
+    return static_cast<size_t>(hash >> (64 - VISIBLE_READERS_BITS));
+}
+
+int64_t now() {
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+} // namespace
+
+bool SpinMutex::tryLockVisible() noexcept {
+    auto& locks = threadLocks;
+    if (locks.count == MAX_THREAD_VISIBLE_LOCKS)
+        return false;
+
+    const size_t slot = visibleReaderSlot(this);
+    const SpinMutex* expected = nullptr;
+    if (!visibleReaders[slot].compare_exchange_strong(expected, this))
+        return false;
+
+    // Writer resets bias before scanning of visible readers
+    if (readBias_) {
+        locks.mutexes[locks.count] = this;
+        locks.slots[locks.count] = slot;
+        ++locks.count;
+        return true;
+    }
+    visibleReaders[slot].store(nullptr, std::memory_order_release);
+    return false;
+}
+
+bool SpinMutex::unlockVisible() noexcept {
+    auto& locks = threadLocks;
+    for (size_t i = locks.count; i > 0; --i) {
+        if (locks.mutexes[i - 1] == this) {
+            visibleReaders[locks.slots[i - 1]].store(nullptr, std::memory_order_release);
+            --locks.count;
+            locks.mutexes[i - 1] = locks.mutexes[locks.count];
+            locks.slots[i - 1] = locks.slots[locks.count];
+            return true;
+        }
+    }
+    return false;
+}
+
+void SpinMutex::revokeReadBias() noexcept {
+    const int64_t start = now();
+    readBias_ = false;
+    for (const auto& reader : visibleReaders) {
+        while (reader == this) {
+            std::this_thread::yield();
+        }
+    }
+    const int64_t finish = now();
+    inhibitUntil_.store(finish + (finish - start) * INHIBIT_MULTIPLIER, std::memory_order_relaxed);
+}
+
+void SpinMutex::tryEnableReadBias() noexcept {
+    if (now() >= inhibitUntil_.load(std::memory_order_relaxed))
+        readBias_ = true;
+}
+
+} // effil
@@ -2,18 +2,33 @@
 
 #include <atomic>
 #include <thread>
+#include <cstdint>
 
 namespace effil {
 
+// Readers-writer spin lock.
+// Read mostly mutex switches readers into biased mode (BRAVO technique):
+// instead of modification of the shared readers counter reader publishes itself
+// in the global table of visible readers, in the slot chosen by thread and mutex.
+// Thus, readers running on different cores don't write to the same cache line.
+// Writer revokes the bias and waits for visible readers to leave.
+// Bias is inhibited for a while after revocation, so frequently written mutexes
+// don't pay for scanning of visible readers.
 class SpinMutex {
 public:
     void lock() noexcept {
         while (lock_.exchange(true, std::memory_order_acquire)) {
             std::this_thread::yield();
         }
+        // Revoke before waiting for the counter, otherwise biased readers keep coming
+        if (readBias_)
+            revokeReadBias();
         while (counter_ != 0) {
             std::this_thread::yield();
         }
+        // Bias could be enabled by the reader which was counted before the lock
+        if (readBias_)
+            revokeReadBias();
     }
 
     void unlock() noexcept {
@@ -21,6 +36,9 @@ public:
     }
 
     void lock_shared() noexcept {
+        if (readBias_.load(std::memory_order_relaxed) && tryLockVisible())
+            return;
+
         while (true) {
             while (lock_) {
                 std::this_thread::yield();
@@ -31,17 +49,30 @@ public:
             if (lock_)
                 counter_.fetch_sub(1, std::memory_order_release);
             else
-                return;
+                break;
         }
+
+        // Readers counter keeps writers away, so it's safe to enable bias here
+        if (!readBias_.load(std::memory_order_relaxed))
+            tryEnableReadBias();
     }
 
     void unlock_shared() noexcept {
-        counter_.fetch_sub(1, std::memory_order_release);
+        if (!unlockVisible())
+            counter_.fetch_sub(1, std::memory_order_release);
     }
 
+private:
+    bool tryLockVisible() noexcept;
+    bool unlockVisible() noexcept;
+    void revokeReadBias() noexcept;
+    void tryEnableReadBias() noexcept;
+
 private:
     std::atomic_int counter_ {0};
     std::atomic_bool lock_ {false};
+    std::atomic_bool readBias_ {false};
+    std::atomic<int64_t> inhibitUntil_ {0};
 };
 
 } // effil
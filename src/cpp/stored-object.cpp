@@ -5,10 +5,15 @@
 #include "function.h"
 #include "utils.h"
 #include "thread_runner.h"
+#include "array.h"
+#include "mapped-table.h"
+#include "cache.h"
 
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <type_traits>
 
 #include <cassert>
 
@@ -18,67 +23,97 @@ namespace {
 
 class ApiReferenceHolder : public BaseHolder {
 public:
-    bool rawCompare(const BaseHolder*) const noexcept final { return true; }
+    ApiReferenceHolder() : BaseHolder(HolderType::ApiReference) {}
+
+    bool rawCompare(const BaseHolder*) const noexcept final { return false; }
+    bool rawEquals(const BaseHolder*) const noexcept final { return true; }
+    size_t rawHash() const noexcept final { return 0; }
+    size_t memory() const final { return sizeof(*this); }
     sol::object unpack(sol::this_state lua) const final {
         luaopen_effil(lua);
         return sol::stack::pop<sol::object>(lua);
     }
 };
 
-class NilHolder : public BaseHolder {
-public:
-    bool rawCompare(const BaseHolder*) const noexcept final { return true; }
-    sol::object unpack(sol::this_state) const final { return sol::nil; }
-};
-
-template <typename StoredType>
-class PrimitiveHolder : public BaseHolder {
+// Strings are interned, so equal strings are compared by pointer
+class StringHolder : public BaseHolder {
 public:
-    PrimitiveHolder(const sol::stack_object& luaObject) noexcept
-            : data_(luaObject.as<StoredType>()) {}
+    template <typename SolObject>
+    StringHolder(const SolObject& luaObject)
+            : BaseHolder(HolderType::String)
+            , data_(internLuaString(luaObject)) {}
 
-    PrimitiveHolder(const sol::object& luaObject) noexcept
-            : data_(luaObject.as<StoredType>()) {}
-
-    PrimitiveHolder(const StoredType& init) noexcept
-            : data_(init) {}
+    StringHolder(const std::string& init)
+            : BaseHolder(HolderType::String)
+            , data_(init) {}
 
     bool rawCompare(const BaseHolder* other) const noexcept final {
-        return data_ < static_cast<const PrimitiveHolder<StoredType>*>(other)->data_;
+        return data_ < static_cast<const StringHolder*>(other)->data_;
+    }
+
+    bool rawEquals(const BaseHolder* other) const noexcept final {
+        return data_ == static_cast<const StringHolder*>(other)->data_;
     }
 
-    sol::object unpack(sol::this_state state) const final { return sol::make_object(state, data_); }
+    size_t rawHash() const noexcept final { return data_.hash(); }
+
+    // Interned string is counted by each holder which refers to it
+    size_t memory() const final { return sizeof(*this) + data_.memory(); }
 
-    StoredType getData() { return data_; }
+    sol::object unpack(sol::this_state state) const final { return sol::make_object(state, data_.str()); }
+
+    const std::string& getData() const { return data_.str(); }
 
 private:
-    StoredType data_;
+    // Lua strings may contain zeros, so take them with the length
+    template <typename SolObject>
+    static InternedString internLuaString(const SolObject& luaObject) {
+        lua_State* state = luaObject.lua_state();
+        sol::stack::push(state, luaObject);
+        size_t size = 0;
+        const char* data = lua_tolstring(state, -1, &size);
+        InternedString result(data, size);
+        lua_pop(state, 1);
+        return result;
+    }
+
+    InternedString data_;
 };
 
-template<typename T>
+template<typename T, HolderType Type>
 class GCObjectHolder : public BaseHolder {
 public:
     template <typename SolType>
-    GCObjectHolder(const SolType& luaObject) {
+    GCObjectHolder(const SolType& luaObject)
+            : BaseHolder(Type) {
         assert(luaObject.template is<T>());
         strongRef_ = luaObject.template as<T>();
         handle_ = strongRef_->handle();
     }
 
     GCObjectHolder(GCHandle handle)
-            : handle_(handle) {
+            : BaseHolder(Type)
+            , handle_(handle) {
         strongRef_ = GC::instance().get<T>(handle_);
     }
 
     bool rawCompare(const BaseHolder* other) const final {
-        return handle_ < static_cast<const GCObjectHolder<T>*>(other)->handle_;
+        return handle_ < static_cast<const GCObjectHolder*>(other)->handle_;
+    }
+
+    bool rawEquals(const BaseHolder* other) const final {
+        return handle_ == static_cast<const GCObjectHolder*>(other)->handle_;
     }
 
+    size_t rawHash() const final { return std::hash<GCHandle>()(handle_); }
+
+    size_t memory() const final { return sizeof(*this); }
+
     sol::object unpack(sol::this_state state) const override {
         return sol::make_object(state, GC::instance().get<T>(handle_));
     }
 
-    GCHandle gcHandle() const override { return handle_; }
+    GCHandle gcHandle() const final { return handle_; }
 
     void releaseStrongReference() override {
         strongRef_ = sol::nullopt;
@@ -95,19 +130,33 @@ protected:
     sol::optional<T> strongRef_;
 };
 
-class SharedTableHolder : public GCObjectHolder<SharedTable> {
+using ChannelHolder = GCObjectHolder<Channel, HolderType::Channel>;
+using ThreadHolder = GCObjectHolder<Thread, HolderType::Thread>;
+using ThreadRunnerHolder = GCObjectHolder<ThreadRunner, HolderType::ThreadRunner>;
+using CacheHolder = GCObjectHolder<Cache, HolderType::Cache>;
+
+class SharedTableHolder : public GCObjectHolder<SharedTable, HolderType::SharedTable> {
 public:
-    using GCObjectHolder<SharedTable>::GCObjectHolder;
+    using GCObjectHolder::GCObjectHolder;
 
     sol::object convertToLua(sol::this_state state, DumpCache& cache) const final {
         return GC::instance().get<SharedTable>(handle_).luaDump(state, cache);
     }
 };
 
-class FunctionHolder : public GCObjectHolder<Function> {
+class ArrayHolder : public GCObjectHolder<Array, HolderType::Array> {
+public:
+    using GCObjectHolder::GCObjectHolder;
+
+    sol::object convertToLua(sol::this_state state, DumpCache&) const final {
+        return GC::instance().get<Array>(handle_).luaDump(state);
+    }
+};
+
+class FunctionHolder : public GCObjectHolder<Function, HolderType::Function> {
 public:
     template <typename SolType>
-    FunctionHolder(const SolType& luaObject) : GCObjectHolder<Function>(luaObject) {}
+    FunctionHolder(const SolType& luaObject) : GCObjectHolder(luaObject) {}
 
     sol::object unpack(sol::this_state state) const final {
         return GC::instance().get<Function>(handle_).loadFunction(state);
@@ -118,10 +167,36 @@ public:
     }
 };
 
+// Mapped tables aren't managed by GC, the holder keeps the mapping alive
+class MappedTableHolder : public BaseHolder {
+public:
+    template <typename SolObject>
+    MappedTableHolder(const SolObject& luaObject)
+            : BaseHolder(HolderType::MappedTable)
+            , table_(luaObject.template as<MappedTable>()) {}
+
+    bool rawCompare(const BaseHolder* other) const final {
+        return table_.less(static_cast<const MappedTableHolder*>(other)->table_);
+    }
+
+    bool rawEquals(const BaseHolder* other) const final {
+        return table_.equals(static_cast<const MappedTableHolder*>(other)->table_);
+    }
+
+    size_t rawHash() const final { return table_.hash(); }
+
+    size_t memory() const final { return sizeof(*this); }
+
+    sol::object unpack(sol::this_state state) const final { return sol::make_object(state, table_); }
+
+private:
+    MappedTable table_;
+};
+
 class CFunctionHolder : public BaseHolder {
 public:
     CFunctionHolder(sol::state_view state, int stack_index)
-        : BaseHolder()
+        : BaseHolder(HolderType::CFunction)
     {
         cfunction_ = lua_tocfunction(state, stack_index);
         REQUIRE(cfunction_ != nullptr) << "can't get C function pointer";
@@ -133,49 +208,109 @@ public:
     }
 
     bool rawCompare(const BaseHolder* other) const override {
-        const auto cfh = dynamic_cast<const CFunctionHolder*>(other);
-        return cfh && cfh->cfunction_ == cfunction_;
+        return std::less<lua_CFunction>()(cfunction_, static_cast<const CFunctionHolder*>(other)->cfunction_);
+    }
+
+    bool rawEquals(const BaseHolder* other) const override {
+        return cfunction_ == static_cast<const CFunctionHolder*>(other)->cfunction_;
     }
 
+    size_t rawHash() const override { return std::hash<lua_CFunction>()(cfunction_); }
+
+    size_t memory() const final { return sizeof(*this); }
+
 private:
     lua_CFunction cfunction_;
 };
 
+template <typename Holder, typename... Args>
+StoredObject makeHolder(Args&&... args) {
+    return StoredObject(std::unique_ptr<BaseHolder>(new Holder(std::forward<Args>(args)...)));
+}
+
 void dumpTable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited);
 
-StoredObject makeStoredObject(const sol::object& luaObject, SolTableToShared& visited) {
+template <typename SolObject>
+const void* luaTablePointer(const SolObject& luaTable) {
+    auto poper = sol::stack::push_pop(luaTable);
+    return lua_topointer(luaTable.lua_state(), -1);
+}
+
+template <typename SolObject>
+StoredObject makeStoredObject(const SolObject& luaObject, SolTableToShared& visited) {
     if (luaObject.get_type() == sol::type::table) {
-        sol::table luaTable = luaObject;
-        auto st = std::find_if(visited.begin(), visited.end(), [&](const auto& pair) {
-            return pair.first == luaObject;
-        });
+        const void* pointer = luaTablePointer(luaObject);
+        const auto st = visited.find(pointer);
         if (st == visited.end()) {
             SharedTable table = GC::instance().create<SharedTable>();
-            visited.push_back({luaTable, table.handle()});
-            dumpTable(table, luaTable, visited);
-            return std::make_unique<SharedTableHolder>(table.handle());
+            visited.emplace(pointer, table.handle());
+            dumpTable(table, luaObject.template as<sol::table>(), visited);
+            return makeHolder<SharedTableHolder>(table.handle());
         } else {
-            return std::make_unique<SharedTableHolder>(st->second);
+            return makeHolder<SharedTableHolder>(st->second);
         }
     } else {
         return createStoredObject(luaObject, visited);
     }
 }
 
+size_t rawLength(lua_State* state, int index) {
+#if LUA_VERSION_NUM == 501
+    return lua_objlen(state, index);
+#else
+    return lua_rawlen(state, index);
+#endif
+}
+
+// Key which belongs to the sequence part 1..length
+bool isSequenceKey(lua_State* state, int index, size_t length) {
+    if (lua_type(state, index) != LUA_TNUMBER)
+        return false;
+    const lua_Number key = lua_tonumber(state, index);
+    return key >= 1 && key <= static_cast<lua_Number>(length) && key == std::floor(key);
+}
+
+// Sequence 1..N is read by index and the rest of entries is read with lua_next.
+// Everything is converted before the target is locked and inserted at once.
 void dumpTable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited) {
-    for (auto& row : luaTable) {
-        target.set(makeStoredObject(row.first, visited), makeStoredObject(row.second, visited));
+    lua_State* state = luaTable.lua_state();
+    auto poper = sol::stack::push_pop(luaTable);
+    const int tableIndex = lua_gettop(state);
+
+    StoredArray sequence;
+    const size_t length = rawLength(state, tableIndex);
+    sequence.reserve(length);
+    for (size_t i = 1; i <= length; ++i) {
+        lua_rawgeti(state, tableIndex, static_cast<int>(i));
+        if (lua_isnil(state, -1)) {
+            // border in the middle of table with holes
+            lua_pop(state, 1);
+            break;
+        }
+        sequence.push_back(makeStoredObject(sol::stack_object(state, lua_gettop(state)), visited));
+        lua_pop(state, 1);
     }
+
+    StoredEntries entries;
+    lua_pushnil(state);
+    while (lua_next(state, tableIndex) != 0) {
+        const int valueIndex = lua_gettop(state);
+        if (!isSequenceKey(state, valueIndex - 1, sequence.size()))
+            entries.emplace_back(makeStoredObject(sol::stack_object(state, valueIndex - 1), visited),
+                                 makeStoredObject(sol::stack_object(state, valueIndex), visited));
+        lua_pop(state, 1);
+    }
+
+    target.setMany(std::move(sequence), std::move(entries));
 }
 
 template <typename SolObject>
 StoredObject fromSolObject(const SolObject& luaObject, SolTableToShared& visited) {
     switch (luaObject.get_type()) {
         case sol::type::nil:
-            return std::make_unique<NilHolder>();
-            break;
+            return StoredObject::nil();
         case sol::type::boolean:
-            return std::make_unique<PrimitiveHolder<bool>>(luaObject);
+            return StoredObject::boolean(luaObject.template as<bool>());
         case sol::type::number:
         {
 #if LUA_VERSION_NUM == 503
@@ -183,86 +318,252 @@ StoredObject fromSolObject(const SolObject& luaObject, SolTableToShared& visited
             int isInterger = lua_isinteger(luaObject.lua_state(), -1);
             sol::stack::pop<sol::object>(luaObject.lua_state());
             if (isInterger)
-                return std::make_unique<PrimitiveHolder<lua_Integer>>(luaObject);
+                return StoredObject::integer(luaObject.template as<lua_Integer>());
             else
 #endif // Lua5.3
-                return std::make_unique<PrimitiveHolder<lua_Number>>(luaObject);
+                return StoredObject::number(luaObject.template as<lua_Number>());
         }
         case sol::type::string:
-            return std::make_unique<PrimitiveHolder<std::string>>(luaObject);
+            return makeHolder<StringHolder>(luaObject);
         case sol::type::lightuserdata:
-            return std::make_unique<PrimitiveHolder<void*>>(luaObject);
+            return StoredObject::lightUserdata(luaObject.template as<void*>());
         case sol::type::userdata:
             if (luaObject.template is<SharedTable>())
-                return std::make_unique<SharedTableHolder>(luaObject);
+                return makeHolder<SharedTableHolder>(luaObject);
             else if (luaObject.template is<Channel>())
-                return std::make_unique<GCObjectHolder<Channel>>(luaObject);
+                return makeHolder<ChannelHolder>(luaObject);
+            else if (luaObject.template is<Array>())
+                return makeHolder<ArrayHolder>(luaObject);
             else if (luaObject.template is<Function>())
-                return std::make_unique<FunctionHolder>(luaObject);
+                return makeHolder<FunctionHolder>(luaObject);
             else if (luaObject.template is<Thread>())
-                return std::make_unique<GCObjectHolder<Thread>>(luaObject);
+                return makeHolder<ThreadHolder>(luaObject);
             else if (luaObject.template is<EffilApiMarker>())
-                return std::make_unique<ApiReferenceHolder>();
+                return makeHolder<ApiReferenceHolder>();
             else if (luaObject.template is<ThreadRunner>())
-                return std::make_unique<GCObjectHolder<ThreadRunner>>(luaObject);
+                return makeHolder<ThreadRunnerHolder>(luaObject);
+            else if (luaObject.template is<MappedTable>())
+                return makeHolder<MappedTableHolder>(luaObject);
+            else if (luaObject.template is<Cache>())
+                return makeHolder<CacheHolder>(luaObject);
             else
                 throw Exception() << "Unable to store userdata object";
         case sol::type::function: {
             {
                 auto poper = sol::stack::push_pop(luaObject);
                 if (lua_iscfunction(luaObject.lua_state(), -1))
-                    return std::make_unique<CFunctionHolder>(luaObject.lua_state(), -1);
+                    return makeHolder<CFunctionHolder>(luaObject.lua_state(), -1);
             }
             Function func = GC::instance().create<Function>(luaObject, visited);
-            return std::make_unique<FunctionHolder>(func.handle());
+            return makeHolder<FunctionHolder>(func.handle());
         }
         case sol::type::table: {
             sol::table luaTable = luaObject;
 
-            const auto iter = std::find_if(visited.begin(), visited.end(), [&](const auto& pair) {
-                return pair.first == luaTable;
-            });
+            const auto iter = visited.find(luaTablePointer(luaTable));
             if (iter != visited.end()) {
-                return std::make_unique<SharedTableHolder>(iter->second);
+                return makeHolder<SharedTableHolder>(iter->second);
             }
             // Tables pool is used to store tables.
             // Right now not defiantly clear how ownership between states works.
             SharedTable table = GC::instance().create<SharedTable>();
-            visited.push_back({luaTable, table.handle()});
-
-            // Let's dump table and all subtables
-            // SolTableToShared is used to prevent from infinity recursion
-            // in recursive tables
-            dumpTable(table, luaTable, visited);
-
-            const sol::table luaMetatable = luaTable[sol::metatable_key];
-            if (luaMetatable.valid()) {
-                SharedTable metaTable = GC::instance().create<SharedTable>();
-                dumpTable(metaTable, luaMetatable, visited);
-                table.setMetatable(metaTable);
-            }
-            return std::make_unique<SharedTableHolder>(table.handle());
+            copyLuaTable(table, luaTable, visited);
+            return makeHolder<SharedTableHolder>(table.handle());
         }
         default:
             throw Exception() << "unable to store object of " << luaTypename(luaObject) << " type";
     }
-    return nullptr;
+    return StoredObject();
 }
 
 } // namespace
 
-StoredObject createStoredObject(bool value) { return std::make_unique<PrimitiveHolder<bool>>(value); }
+bool StoredKeyView::compare(const StoredObject& other) const {
+    if (object_)
+        return object_->compare(other);
+    if (other.type() != StoredObject::Type::Holder)
+        return StoredObject::Type::Holder < other.type();
+    if (other.holder()->type() != HolderType::String)
+        return HolderType::String < other.holder()->type();
+
+    const std::string& str = static_cast<const StringHolder*>(other.holder())->getData();
+    const int result = std::char_traits<char>::compare(data_, str.data(), std::min(size_, str.size()));
+    return result != 0 ? result < 0 : size_ < str.size();
+}
+
+bool StoredKeyView::equals(const StoredObject& other) const {
+    if (object_)
+        return object_->equals(other);
+    if (other.type() != StoredObject::Type::Holder || other.holder()->type() != HolderType::String)
+        return false;
+
+    const std::string& str = static_cast<const StringHolder*>(other.holder())->getData();
+    return str.size() == size_ && std::char_traits<char>::compare(data_, str.data(), size_) == 0;
+}
+
+size_t StoredKeyView::rawHash() const {
+    return object_ ? object_->rawHash() : hashString(data_, size_);
+}
+
+bool StoredObject::compare(const StoredObject& other) const {
+    if (type_ != other.type_)
+        return type_ < other.type_;
+    switch (type_) {
+        case Type::Empty:
+        case Type::Nil:
+            return false;
+        case Type::Boolean:
+            return boolean_ < other.boolean_;
+        case Type::Integer:
+            return integer_ < other.integer_;
+        case Type::Number:
+            return number_ < other.number_;
+        case Type::LightUserdata:
+            return std::less<void*>()(pointer_, other.pointer_);
+        case Type::Holder:
+            return holder_->compare(other.holder_);
+    }
+    return false;
+}
+
+bool StoredObject::equals(const StoredObject& other) const {
+    if (type_ != other.type_)
+        return false;
+    switch (type_) {
+        case Type::Empty:
+        case Type::Nil:
+            return true;
+        case Type::Boolean:
+            return boolean_ == other.boolean_;
+        case Type::Integer:
+            return integer_ == other.integer_;
+        case Type::Number:
+            return number_ == other.number_;
+        case Type::LightUserdata:
+            return pointer_ == other.pointer_;
+        case Type::Holder:
+            return holder_->equals(other.holder_);
+    }
+    return false;
+}
+
+size_t StoredObject::rawHash() const {
+    switch (type_) {
+        case Type::Empty:
+        case Type::Nil:
+            return 0;
+        case Type::Boolean:
+            return std::hash<bool>()(boolean_);
+        case Type::Integer:
+            return std::hash<lua_Integer>()(integer_);
+        case Type::Number:
+            return std::hash<lua_Number>()(number_);
+        case Type::LightUserdata:
+            return std::hash<void*>()(pointer_);
+        case Type::Holder:
+            return holder_->rawHash();
+    }
+    return 0;
+}
+
+sol::object StoredObject::unpack(sol::this_state state) const {
+    switch (type_) {
+        case Type::Empty:
+        case Type::Nil:
+            break;
+        case Type::Boolean:
+            return sol::make_object(state, boolean_);
+        case Type::Integer:
+            return sol::make_object(state, integer_);
+        case Type::Number:
+            return sol::make_object(state, number_);
+        case Type::LightUserdata:
+            return sol::make_object(state, pointer_);
+        case Type::Holder:
+            return holder_->unpack(state);
+    }
+    return sol::nil;
+}
+
+void StoredObject::push(lua_State* state) const {
+    switch (type_) {
+        case Type::Empty:
+        case Type::Nil:
+            lua_pushnil(state);
+            break;
+        case Type::Boolean:
+            lua_pushboolean(state, boolean_ ? 1 : 0);
+            break;
+        case Type::Integer:
+            lua_pushinteger(state, integer_);
+            break;
+        case Type::Number:
+            lua_pushnumber(state, number_);
+            break;
+        case Type::LightUserdata:
+            lua_pushlightuserdata(state, pointer_);
+            break;
+        case Type::Holder:
+            if (holder_->type() == HolderType::String) {
+                const std::string& str = static_cast<const StringHolder*>(holder_)->getData();
+                lua_pushlstring(state, str.data(), str.size());
+            } else {
+                sol::stack::push(state, holder_->unpack(sol::this_state{state}));
+            }
+            break;
+    }
+}
+
+sol::object StoredObject::convertToLua(sol::this_state state, BaseHolder::DumpCache& cache) const {
+    if (type_ == Type::Holder)
+        return holder_->convertToLua(state, cache);
+    return unpack(state);
+}
+
+void copyLuaTable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited) {
+    visited.emplace(luaTablePointer(luaTable), target.handle());
+
+    // Let's dump table and all subtables
+    // SolTableToShared is used to prevent from infinity recursion
+    // in recursive tables
+    dumpTable(target, luaTable, visited);
+
+    const sol::table luaMetatable = luaTable[sol::metatable_key];
+    if (luaMetatable.valid()) {
+        SharedTable metaTable = GC::instance().create<SharedTable>();
+        dumpTable(metaTable, luaMetatable, visited);
+        target.setMetatable(metaTable);
+    }
+}
 
-StoredObject createStoredObject(lua_Number value) { return std::make_unique<PrimitiveHolder<lua_Number>>(value); }
+StoredObject createStoredObject(bool value) { return StoredObject::boolean(value); }
 
-StoredObject createStoredObject(lua_Integer value) { return std::make_unique<PrimitiveHolder<lua_Integer>>(value); }
+StoredObject createStoredObject(lua_Number value) { return StoredObject::number(value); }
+
+StoredObject createStoredObject(lua_Integer value) { return StoredObject::integer(value); }
 
 StoredObject createStoredObject(const std::string& value) {
-    return std::make_unique<PrimitiveHolder<std::string>>(value);
+    return makeHolder<StringHolder>(value);
 }
 
 StoredObject createStoredObject(const char* value) {
-    return std::make_unique<PrimitiveHolder<std::string>>(value);
+    return makeHolder<StringHolder>(std::string(value));
+}
+
+StoredObject createStoredObject(const SharedTable& table) {
+    return makeHolder<SharedTableHolder>(table.handle());
+}
+
+StoredObject createStoredObject(const Function& function) {
+    return makeHolder<FunctionHolder>(function.handle());
+}
+
+StoredObject createStoredObject(const Array& array) {
+    return makeHolder<ArrayHolder>(array.handle());
+}
+
+StoredObject createStoredApiReference() {
+    return makeHolder<ApiReferenceHolder>();
 }
 
 StoredObject createStoredObject(const sol::object& object) {
@@ -283,37 +584,81 @@ StoredObject createStoredObject(const sol::stack_object& obj, SolTableToShared&
     return fromSolObject(obj, visited);
 }
 
-template <typename DataType>
-sol::optional<DataType> getPrimitiveHolderData(const StoredObject& sobj) {
-    auto ptr = dynamic_cast<PrimitiveHolder<DataType>*>(sobj.get());
-    if (ptr)
-        return ptr->getData();
-    return sol::optional<DataType>();
+sol::optional<bool> storedObjectToBool(const StoredObject& sobj) {
+    if (sobj.type() == StoredObject::Type::Boolean)
+        return sobj.toBoolean();
+    return sol::nullopt;
 }
 
-sol::optional<bool> storedObjectToBool(const StoredObject& sobj) { return getPrimitiveHolderData<bool>(sobj); }
-
-sol::optional<double> storedObjectToDouble(const StoredObject& sobj) { return getPrimitiveHolderData<double>(sobj); }
+sol::optional<double> storedObjectToDouble(const StoredObject& sobj) {
+    if (sobj.type() == StoredObject::Type::Number)
+        return sobj.toNumber();
+    return sol::nullopt;
+}
 
-sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject& sobj) { return getPrimitiveHolderData<LUA_INDEX_TYPE>(sobj); }
+sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject& sobj) {
+#if LUA_VERSION_NUM == 503
+    if (sobj.type() == StoredObject::Type::Integer)
+        return sobj.toInteger();
+#else
+    if (sobj.type() == StoredObject::Type::Number)
+        return sobj.toNumber();
+#endif // Lua5.3
+    return sol::nullopt;
+}
 
 sol::optional<std::string> storedObjectToString(const StoredObject& sobj) {
-    return getPrimitiveHolderData<std::string>(sobj);
+    const BaseHolder* holder = sobj.holder();
+    if (holder != nullptr && holder->type() == HolderType::String)
+        return static_cast<const StringHolder*>(holder)->getData();
+    return sol::nullopt;
+}
+
+const std::string* storedObjectToStringPointer(const StoredObject& sobj) {
+    const BaseHolder* holder = sobj.holder();
+    if (holder != nullptr && holder->type() == HolderType::String)
+        return &static_cast<const StringHolder*>(holder)->getData();
+    return nullptr;
+}
+
+sol::optional<lua_Number> storedObjectToNumber(const StoredObject& sobj) {
+    if (sobj.type() == StoredObject::Type::Number)
+        return sobj.toNumber();
+    if (sobj.type() == StoredObject::Type::Integer)
+        return static_cast<lua_Number>(sobj.toInteger());
+    return sol::nullopt;
+}
+
+bool addToStoredNumber(StoredObject& sobj, const StoredObject& delta) {
+    if (sobj.type() == StoredObject::Type::Integer && delta.type() == StoredObject::Type::Integer) {
+        // integer overflow wraps around like in Lua
+        typedef std::make_unsigned<lua_Integer>::type Unsigned;
+        sobj = StoredObject::integer(static_cast<lua_Integer>(
+                static_cast<Unsigned>(sobj.toInteger()) + static_cast<Unsigned>(delta.toInteger())));
+        return true;
+    }
+
+    const auto number = storedObjectToNumber(sobj);
+    const auto numberDelta = storedObjectToNumber(delta);
+    if (!number || !numberDelta)
+        return false;
+    sobj = StoredObject::number(*number + *numberDelta);
+    return true;
 }
 
 template<>
 sol::optional<SharedTable> storedObjectTo(const StoredObject& obj) {
-    if (const auto ptr = std::dynamic_pointer_cast<SharedTableHolder>(obj)) {
-        return GC::instance().get<SharedTable>(ptr->gcHandle());
-    }
+    const BaseHolder* holder = obj.holder();
+    if (holder != nullptr && holder->type() == HolderType::SharedTable)
+        return GC::instance().get<SharedTable>(static_cast<const SharedTableHolder*>(holder)->gcHandle());
     return sol::nullopt;
 }
 
 template<>
 sol::optional<Function> storedObjectTo(const StoredObject& obj) {
-    if (const auto ptr = std::dynamic_pointer_cast<FunctionHolder>(obj)) {
-        return GC::instance().get<Function>(ptr->gcHandle());
-    }
+    const BaseHolder* holder = obj.holder();
+    if (holder != nullptr && holder->type() == HolderType::Function)
+        return GC::instance().get<Function>(static_cast<const FunctionHolder*>(holder)->gcHandle());
     return sol::nullopt;
 }
 
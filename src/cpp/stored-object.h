@@ -2,33 +2,70 @@
 
 #include "utils.h"
 #include "garbage-collector.h"
+#include "slab-allocator.h"
+#include "string-pool.h"
 
 #include <sol.hpp>
 
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
 namespace effil {
 
 struct EffilApiMarker{};
 
+// Type tag of holder, allows to check type and order holders without RTTI
+enum class HolderType : uint8_t {
+    String,
+    CFunction,
+    ApiReference,
+    SharedTable,
+    Channel,
+    Array,
+    Function,
+    Thread,
+    ThreadRunner,
+    MappedTable,
+    Cache
+};
+
 // Represents an interface for lua type stored at C++ code
 class BaseHolder {
 public:
-    BaseHolder() = default;
+    explicit BaseHolder(HolderType type) : type_(type) {}
     virtual ~BaseHolder() = default;
 
+    HolderType type() const { return type_; }
+
+    // Holders are small and allocated often, so they live in slabs
+    static void* operator new(size_t size) { return slabAllocate(size); }
+    static void operator delete(void* block, size_t size) noexcept { slabDeallocate(block, size); }
+
     bool compare(const BaseHolder* other) const {
-        if (typeid(*this) == typeid(*other))
+        if (type_ == other->type_)
             return rawCompare(other);
-        return typeid(*this).before(typeid(*other));
+        return type_ < other->type_;
+    }
+
+    bool equals(const BaseHolder* other) const {
+        return type_ == other->type_ && rawEquals(other);
     }
 
     virtual bool rawCompare(const BaseHolder* other) const = 0;
-    virtual const std::type_info& type() { return typeid(*this); }
+    virtual bool rawEquals(const BaseHolder* other) const = 0;
+    virtual size_t rawHash() const = 0;
     virtual sol::object unpack(sol::this_state state) const = 0;
+    // Bytes of the holder and its data, GC objects are accounted on their own
+    virtual size_t memory() const = 0;
     virtual GCHandle gcHandle() const { return GCNull; }
     virtual void releaseStrongReference() { }
     virtual void holdStrongReference() { }
 
 
+    // Registry references of Lua tables created by dump
     using DumpCache = std::unordered_map<GCHandle, int>;
     virtual sol::object convertToLua(sol::this_state state, DumpCache&) const {
         return unpack(state);
@@ -36,12 +73,163 @@ public:
 
 private:
     BaseHolder(const BaseHolder&) = delete;
+
+    const HolderType type_;
+
+    // Intrusive reference counter managed by StoredObject
+    friend class StoredObject;
+    std::atomic<size_t> references_ {1};
 };
 
-typedef std::shared_ptr<BaseHolder> StoredObject;
+// Value of lua type stored at C++ code.
+// Primitive values (nil, boolean, number, light userdata) are kept inline,
+// other types are kept in the reference counted holder.
+// Default constructed object is empty, it's not the same as stored nil.
+class StoredObject {
+public:
+    enum class Type : uint8_t {
+        Empty,
+        Nil,
+        Boolean,
+        Integer,
+        Number,
+        LightUserdata,
+        Holder
+    };
+
+public:
+    StoredObject() noexcept : type_(Type::Empty) { pointer_ = nullptr; }
+    StoredObject(std::nullptr_t) noexcept : StoredObject() {}
+
+    // Takes ownership of the holder
+    explicit StoredObject(std::unique_ptr<BaseHolder> holder) noexcept : type_(Type::Holder) {
+        holder_ = holder.release();
+    }
+
+    StoredObject(const StoredObject& other) noexcept : type_(other.type_), raw_(other.raw_) {
+        if (type_ == Type::Holder)
+            holder_->references_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    StoredObject(StoredObject&& other) noexcept : type_(other.type_), raw_(other.raw_) {
+        other.type_ = Type::Empty;
+    }
+
+    StoredObject& operator=(StoredObject other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~StoredObject() {
+        if (type_ == Type::Holder && holder_->references_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete holder_;
+    }
+
+    void swap(StoredObject& other) noexcept {
+        std::swap(type_, other.type_);
+        std::swap(raw_, other.raw_);
+    }
 
-struct StoredObjectLess {
-    bool operator()(const StoredObject& lhs, const StoredObject& rhs) const { return lhs->compare(rhs.get()); }
+    static StoredObject nil() noexcept { return StoredObject(Type::Nil); }
+    static StoredObject boolean(bool value) noexcept {
+        StoredObject result(Type::Boolean);
+        result.boolean_ = value;
+        return result;
+    }
+    static StoredObject integer(lua_Integer value) noexcept {
+        StoredObject result(Type::Integer);
+        result.integer_ = value;
+        return result;
+    }
+    static StoredObject number(lua_Number value) noexcept {
+        StoredObject result(Type::Number);
+        result.number_ = value;
+        return result;
+    }
+    static StoredObject lightUserdata(void* value) noexcept {
+        StoredObject result(Type::LightUserdata);
+        result.pointer_ = value;
+        return result;
+    }
+
+    explicit operator bool() const noexcept { return type_ != Type::Empty; }
+
+    Type type() const noexcept { return type_; }
+    bool toBoolean() const noexcept { return boolean_; }
+    lua_Integer toInteger() const noexcept { return integer_; }
+    lua_Number toNumber() const noexcept { return number_; }
+    void* toPointer() const noexcept { return pointer_; }
+    // nullptr for primitive values
+    BaseHolder* holder() const noexcept { return type_ == Type::Holder ? holder_ : nullptr; }
+
+    // Strict weak ordering which is consistent with equals
+    bool compare(const StoredObject& other) const;
+    bool equals(const StoredObject& other) const;
+    size_t rawHash() const;
+
+    sol::object unpack(sol::this_state state) const;
+    // Pushes the value onto the Lua stack, primitives and strings are pushed without sol objects
+    void push(lua_State* state) const;
+    sol::object convertToLua(sol::this_state state, BaseHolder::DumpCache& cache) const;
+
+    // Bytes held outside of the object, primitive values hold nothing
+    size_t memory() const { return type_ == Type::Holder ? holder_->memory() : 0; }
+
+    GCHandle gcHandle() const { return type_ == Type::Holder ? holder_->gcHandle() : GCNull; }
+    void releaseStrongReference() {
+        if (type_ == Type::Holder)
+            holder_->releaseStrongReference();
+    }
+    void holdStrongReference() {
+        if (type_ == Type::Holder)
+            holder_->holdStrongReference();
+    }
+
+private:
+    explicit StoredObject(Type type) noexcept : type_(type) { raw_ = 0; }
+
+private:
+    Type type_;
+    union {
+        bool boolean_;
+        lua_Integer integer_;
+        lua_Number number_;
+        void* pointer_;
+        BaseHolder* holder_;
+        uint64_t raw_; // used to copy the whole value
+    };
+
+    static_assert(sizeof(lua_Integer) <= sizeof(uint64_t) && sizeof(lua_Number) <= sizeof(uint64_t),
+                  "value doesn't fit into raw_");
+};
+
+inline void swap(StoredObject& left, StoredObject& right) noexcept {
+    left.swap(right);
+}
+
+// Non-owning key used to look up tables.
+// String keys are referenced right on the Lua stack, so lookup of them
+// doesn't require a copy. Other keys refer to the existing StoredObject.
+// View must not outlive the referenced value.
+class StoredKeyView {
+public:
+    StoredKeyView(const StoredObject& object) noexcept
+            : object_(&object), data_(nullptr), size_(0) {}
+    StoredKeyView(const char* data, size_t size) noexcept
+            : object_(nullptr), data_(data), size_(size) {}
+
+    // nullptr for string views
+    const StoredObject* object() const noexcept { return object_; }
+
+    // Consistent with the same methods of StoredObject
+    bool compare(const StoredObject& other) const;
+    bool equals(const StoredObject& other) const;
+    size_t rawHash() const;
+
+private:
+    const StoredObject* object_;
+    const char* data_;
+    size_t size_;
 };
 
 StoredObject createStoredObject(bool);
@@ -52,15 +240,52 @@ StoredObject createStoredObject(const char*);
 StoredObject createStoredObject(const sol::object&);
 StoredObject createStoredObject(const sol::stack_object&);
 
-using SolTableToShared = std::vector<std::pair<sol::table, GCHandle>>;
+class SharedTable;
+class Function;
+class Array;
+
+StoredObject createStoredObject(const SharedTable&);
+StoredObject createStoredObject(const Function&);
+StoredObject createStoredObject(const Array&);
+// Reference to the effil module itself
+StoredObject createStoredApiReference();
+
+// Lua tables which are already converted to shared ones, keyed by lua_topointer.
+// Converted tables are reachable from the source object, so pointers stay valid during conversion.
+using SolTableToShared = std::unordered_map<const void*, GCHandle>;
 
 StoredObject createStoredObject(const sol::object& obj, SolTableToShared& visited);
 StoredObject createStoredObject(const sol::stack_object& obj, SolTableToShared& visited);
 
+// Calls func with the view of Lua value used as a key.
+// Strings are not copied, other values are converted to StoredObject.
+template <typename Func>
+auto withStoredKeyView(const sol::stack_object& luaKey, Func&& func)
+        -> decltype(func(std::declval<const StoredKeyView&>())) {
+    if (luaKey.get_type() == sol::type::string) {
+        size_t size = 0;
+        const char* data = lua_tolstring(luaKey.lua_state(), luaKey.stack_index(), &size);
+        return func(StoredKeyView(data, size));
+    }
+    const StoredObject key = createStoredObject(luaKey);
+    return func(StoredKeyView(key));
+}
+
+// Copies entries and metatable of the Lua table into the shared one
+void copyLuaTable(SharedTable& target, const sol::table& luaTable, SolTableToShared& visited);
+
 sol::optional<bool> storedObjectToBool(const StoredObject&);
 sol::optional<double> storedObjectToDouble(const StoredObject&);
 sol::optional<LUA_INDEX_TYPE> storedObjectToIndexType(const StoredObject&);
 sol::optional<std::string> storedObjectToString(const StoredObject&);
+// Stored string without a copy or nullptr, it's valid while the object is alive
+const std::string* storedObjectToStringPointer(const StoredObject&);
+// Value of integer or floating point number
+sol::optional<lua_Number> storedObjectToNumber(const StoredObject&);
+
+// Adds delta to the stored number.
+// Returns false if any of objects is not a number.
+bool addToStoredNumber(StoredObject& sobj, const StoredObject& delta);
 
 template<typename T>
 sol::optional<T> storedObjectTo(const StoredObject&);
@@ -0,0 +1,128 @@
+#include "string-pool.h"
+#include "spin-mutex.h"
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace effil {
+
+namespace {
+
+typedef std::unique_lock<SpinMutex> UniqueLock;
+typedef std::shared_lock<SpinMutex> SharedLock;
+
+// Strings are distributed between independently locked shards by hash
+constexpr unsigned SHARD_BITS = 6;
+constexpr size_t SHARDS_COUNT = size_t(1) << SHARD_BITS;
+
+class StringPool {
+public:
+    using Entry = InternedString::Entry;
+
+    Entry* acquire(const char* data, size_t size) {
+        const size_t hash = hashString(data, size);
+        Shard& shard = shardByHash(hash);
+        {
+            SharedLock lock(shard.lock);
+            if (Entry* entry = find(shard, hash, data, size))
+                return entry;
+        }
+
+        UniqueLock lock(shard.lock);
+        if (Entry* entry = find(shard, hash, data, size))
+            return entry;
+        Entry* entry = new Entry(data, size, hash);
+        shard.entries.emplace(hash, entry);
+        return entry;
+    }
+
+    void release(Entry* entry) {
+        if (entry->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        // Dead entry is never acquired again, so nobody else touches it
+        Shard& shard = shardByHash(entry->hash);
+        {
+            UniqueLock lock(shard.lock);
+            const auto range = shard.entries.equal_range(entry->hash);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == entry) {
+                    shard.entries.erase(it);
+                    break;
+                }
+            }
+        }
+        delete entry;
+    }
+
+private:
+    struct Shard {
+        SpinMutex lock;
+        std::unordered_multimap<size_t, Entry*> entries;
+        // keep locks of neighbour shards in different cache lines
+        char padding[64];
+    };
+
+    Shard& shardByHash(size_t hash) {
+        // Fibonacci hashing: high bits of the product depend on all bits of the hash
+        return shards_[(static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ull) >> (64 - SHARD_BITS)];
+    }
+
+    // Returns acquired live entry or nullptr.
+    // Entry which is being released may still be in the pool, it's skipped.
+    static Entry* find(Shard& shard, size_t hash, const char* data, size_t size) {
+        const auto range = shard.entries.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            Entry* entry = it->second;
+            if (entry->data.size() != size || std::memcmp(entry->data.data(), data, size) != 0)
+                continue;
+
+            size_t references = entry->references.load(std::memory_order_relaxed);
+            while (references != 0) {
+                if (entry->references.compare_exchange_weak(references, references + 1, std::memory_order_relaxed))
+                    return entry;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    Shard shards_[SHARDS_COUNT];
+};
+
+// Pool is never destroyed, because strings may be released
+// by destructors of other static objects
+StringPool& pool() {
+    static StringPool* instance = new StringPool();
+    return *instance;
+}
+
+} // namespace
+
+size_t hashString(const char* data, size_t size) noexcept {
+    // FNV-1a over 8 byte words, the tail is processed byte by byte.
+    // Users mix the result once again, so it's enough to be injective for short keys.
+    constexpr uint64_t prime = 0x100000001b3ull;
+    uint64_t hash = 0xcbf29ce484222325ull ^ size;
+    for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data, sizeof(word));
+        hash = (hash ^ word) * prime;
+    }
+    for (; size > 0; ++data, --size)
+        hash = (hash ^ static_cast<unsigned char>(*data)) * prime;
+    return static_cast<size_t>(hash);
+}
+
+InternedString::InternedString(const char* data, size_t size)
+        : entry_(pool().acquire(data, size)) {}
+
+InternedString::~InternedString() {
+    if (entry_ != nullptr)
+        pool().release(entry_);
+}
+
+} // effil
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "slab-allocator.h"
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+namespace effil {
+
+// Hash of string bytes, the same for interned strings and string views
+size_t hashString(const char* data, size_t size) noexcept;
+
+// Handle of the string kept in the global intern pool.
+// Equal strings share the only copy, so handles of equal strings
+// point to the same entry and can be compared by pointer.
+// Entry is removed from the pool with the last handle.
+class InternedString {
+public:
+    struct Entry {
+        Entry(const char* data, size_t size, size_t hash)
+                : data(data, size), hash(hash) {}
+
+        static void* operator new(size_t size) { return slabAllocate(size); }
+        static void operator delete(void* block, size_t size) noexcept { slabDeallocate(block, size); }
+
+        const std::string data;
+        const size_t hash;
+        std::atomic<size_t> references {1};
+    };
+
+public:
+    InternedString(const char* data, size_t size);
+    explicit InternedString(const std::string& str) : InternedString(str.data(), str.size()) {}
+
+    InternedString(const InternedString& other) noexcept : entry_(other.entry_) {
+        entry_->references.fetch_add(1, std::memory_order_relaxed);
+    }
+    InternedString(InternedString&& other) noexcept : entry_(other.entry_) {
+        other.entry_ = nullptr;
+    }
+    InternedString& operator=(const InternedString&) = delete;
+    ~InternedString();
+
+    const std::string& str() const noexcept { return entry_->data; }
+    size_t hash() const noexcept { return entry_->hash; }
+    // Bytes of the pool entry, which is shared by all equal strings
+    size_t memory() const noexcept { return sizeof(Entry) + entry_->data.capacity(); }
+
+    bool operator==(const InternedString& other) const noexcept { return entry_ == other.entry_; }
+    bool operator<(const InternedString& other) const noexcept {
+        return entry_ != other.entry_ && entry_->data < other.entry_->data;
+    }
+
+private:
+    Entry* entry_;
+};
+
+} // effil
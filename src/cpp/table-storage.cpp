@@ -0,0 +1,314 @@
+#include "table-storage.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace effil {
+
+namespace {
+
+constexpr size_t MINIMUM_BUCKETS = 4;
+constexpr size_t MINIMUM_OVERFLOW = 4;
+
+// Load factor is 3/4
+bool isOverloaded(size_t size, size_t buckets) {
+    return size * 4 > buckets * 3;
+}
+
+unsigned log2Floor(size_t value) {
+    unsigned result = 0;
+    while (value >>= 1)
+        ++result;
+    return result;
+}
+
+} // namespace
+
+constexpr size_t TableStorage::npos;
+
+TableStorage::TableStorage()
+        : arrayCount_(0)
+        , border_(0)
+        , buckets_(0)
+        , overflow_(MINIMUM_OVERFLOW)
+        , shift_(0)
+        , size_(0)
+        , heldMemory_(0) {}
+
+uint64_t TableStorage::hashOf(const StoredKeyView& key) {
+    // splitmix64 finalizer: spreads raw hashes over the high bits used as bucket index
+    uint64_t hash = static_cast<uint64_t>(key.rawHash()) + 0x9e3779b97f4a7c15ull;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+// Position of the key or position where the key should be inserted.
+// Entry is always placed at or after its home bucket and
+// there are no empty slots between them.
+size_t TableStorage::lowerBound(uint64_t hash, const StoredKeyView& key, bool& found) const {
+    found = false;
+    if (slots_.empty())
+        return 0;
+
+    size_t pos = home(hash);
+    for (; pos < slots_.size(); ++pos) {
+        const Entry& entry = slots_[pos];
+        if (!entry.key || entry.hash > hash)
+            break;
+        if (entry.hash == hash) {
+            if (key.equals(entry.key)) {
+                found = true;
+                break;
+            }
+            // keys with equal hashes are ordered in a usual way
+            if (key.compare(entry.key))
+                break;
+        }
+    }
+    return pos;
+}
+
+size_t TableStorage::arrayIndex(const StoredKeyView& key) const {
+    // string keys never get into the array part
+    if (key.object() == nullptr)
+        return 0;
+    const auto index = storedObjectToIndexType(*key.object());
+    if (!index || *index < 1 || *index > static_cast<LUA_INDEX_TYPE>(array_.size() + 1))
+        return 0;
+
+    const size_t result = static_cast<size_t>(*index);
+    return static_cast<LUA_INDEX_TYPE>(result) == *index ? result : 0;
+}
+
+// Moves entries which follow the array part from the hash part
+void TableStorage::migrateToArray() {
+    while (size_ != 0) {
+        Entry entry = hashErase(createStoredObject(static_cast<LUA_INDEX_TYPE>(array_.size() + 1)));
+        if (!entry.key)
+            break;
+        array_.push_back(std::move(entry.value));
+        ++arrayCount_;
+    }
+}
+
+const StoredObject* TableStorage::find(const StoredKeyView& key) const {
+    if (const size_t index = arrayIndex(key))
+        return findIndex(index);
+
+    bool found;
+    const size_t pos = lowerBound(hashOf(key), key, found);
+    return found ? &slots_[pos].value : nullptr;
+}
+
+const StoredObject* TableStorage::findIndex(size_t index) const {
+    // Hash part never contains keys which are able to get into the array part
+    if (index >= 1 && index <= array_.size() && array_[index - 1])
+        return &array_[index - 1];
+    return nullptr;
+}
+
+StoredObject TableStorage::set(StoredObject&& key, StoredObject&& value) {
+    // Key is dropped if it's already present
+    const size_t keyMemory = key.memory();
+    const size_t valueMemory = value.memory();
+    StoredObject replaced = insert(std::move(key), std::move(value));
+    heldMemory_ += valueMemory + (replaced ? 0 : keyMemory);
+    heldMemory_ -= replaced.memory();
+    return replaced;
+}
+
+StoredObject TableStorage::insert(StoredObject&& key, StoredObject&& value) {
+    const size_t index = arrayIndex(key);
+    if (index == 0) {
+        StoredObject replaced = hashSet(std::move(key), std::move(value));
+        if (!replaced)
+            shrinkArray();
+        return replaced;
+    }
+
+    if (index <= array_.size()) {
+        std::swap(array_[index - 1], value);
+        if (!value) {
+            ++arrayCount_;
+            shrinkArray();
+        }
+    }
+    else {
+        array_.push_back(std::move(value));
+        ++arrayCount_;
+        migrateToArray();
+    }
+
+    while (border_ < array_.size() && array_[border_])
+        ++border_;
+    return std::move(value);
+}
+
+// Trailing holes are removed only on insertion of the new key, because
+// it's not allowed during iteration, so positions of removed keys are still valid
+void TableStorage::shrinkArray() {
+    while (!array_.empty() && !array_.back())
+        array_.pop_back();
+}
+
+TableStorage::Entry TableStorage::erase(const StoredObject& key) {
+    Entry removed = remove(key);
+    heldMemory_ -= removed.key.memory() + removed.value.memory();
+    return removed;
+}
+
+TableStorage::Entry TableStorage::remove(const StoredObject& key) {
+    const size_t index = arrayIndex(key);
+    if (index == 0)
+        return hashErase(key);
+    if (index > array_.size() || !array_[index - 1])
+        return Entry{0, nullptr, nullptr};
+
+    Entry removed{0, key, std::move(array_[index - 1])};
+    --arrayCount_;
+    if (index <= border_)
+        border_ = index - 1;
+    return removed;
+}
+
+size_t TableStorage::next(const StoredKeyView& key) const {
+    if (const size_t index = arrayIndex(key))
+        return seek(index);
+
+    bool found;
+    const size_t pos = lowerBound(hashOf(key), key, found);
+    return seek(array_.size() + pos + (found ? 1 : 0));
+}
+
+// First occupied position starting from the given one
+size_t TableStorage::seek(size_t position) const {
+    for (; position < array_.size(); ++position)
+        if (array_[position])
+            return position;
+    for (size_t slot = position - array_.size(); slot < slots_.size(); ++slot)
+        if (slots_[slot].key)
+            return array_.size() + slot;
+    return npos;
+}
+
+StoredObject TableStorage::keyAt(size_t position) const {
+    if (position < array_.size())
+        return createStoredObject(static_cast<LUA_INDEX_TYPE>(position + 1));
+    return slots_[position - array_.size()].key;
+}
+
+const StoredObject& TableStorage::valueAt(size_t position) const {
+    if (position < array_.size())
+        return array_[position];
+    return slots_[position - array_.size()].value;
+}
+
+StoredObject TableStorage::hashSet(StoredObject&& key, StoredObject&& value) {
+    const uint64_t hash = hashOf(key);
+
+    bool found;
+    size_t pos = lowerBound(hash, key, found);
+    if (found) {
+        std::swap(slots_[pos].value, value);
+        return std::move(value);
+    }
+
+    if (slots_.empty() || isOverloaded(size_ + 1, buckets_))
+        rehash(std::max(buckets_ * 2, MINIMUM_BUCKETS));
+
+    size_t freeSlot;
+    while (true) {
+        pos = lowerBound(hash, key, found);
+        freeSlot = pos;
+        while (freeSlot < slots_.size() && slots_[freeSlot].key)
+            ++freeSlot;
+        if (freeSlot < slots_.size())
+            break;
+        // Run of slots reached the end of table
+        overflow_ *= 2;
+        rehash(buckets_);
+    }
+
+    std::move_backward(slots_.begin() + pos, slots_.begin() + freeSlot, slots_.begin() + freeSlot + 1);
+    slots_[pos] = Entry{hash, std::move(key), std::move(value)};
+    ++size_;
+    return nullptr;
+}
+
+TableStorage::Entry TableStorage::hashErase(const StoredObject& key) {
+    bool found;
+    size_t pos = lowerBound(hashOf(key), key, found);
+    if (!found)
+        return Entry{0, nullptr, nullptr};
+
+    Entry removed = std::move(slots_[pos]);
+    // Shift following entries back to keep them close to their home buckets
+    for (++pos; pos < slots_.size() && slots_[pos].key && home(slots_[pos].hash) < pos; ++pos)
+        slots_[pos - 1] = std::move(slots_[pos]);
+    slots_[pos - 1] = Entry{0, nullptr, nullptr};
+
+    --size_;
+    return removed;
+}
+
+void TableStorage::compact() {
+    shrinkArray();
+    array_.shrink_to_fit();
+
+    if (size_ == 0) {
+        std::vector<Entry>().swap(slots_);
+        buckets_ = 0;
+        overflow_ = MINIMUM_OVERFLOW;
+        return;
+    }
+
+    size_t buckets = MINIMUM_BUCKETS;
+    while (isOverloaded(size_, buckets))
+        buckets *= 2;
+    overflow_ = MINIMUM_OVERFLOW;
+    rehash(buckets);
+}
+
+void TableStorage::reserve(size_t arraySize, size_t hashSize) {
+    array_.reserve(arraySize);
+    if (hashSize == 0)
+        return;
+
+    size_t buckets = std::max(buckets_, MINIMUM_BUCKETS);
+    while (isOverloaded(size_ + hashSize, buckets))
+        buckets *= 2;
+    if (buckets != buckets_)
+        rehash(buckets);
+}
+
+void TableStorage::rehash(size_t buckets) {
+    assert(buckets >= MINIMUM_BUCKETS && (buckets & (buckets - 1)) == 0);
+    const unsigned shift = 64 - log2Floor(buckets);
+
+    // Entries are already sorted, so each of them is placed
+    // at its home bucket or right after the previous one.
+    // Make sure that the last run fits and one free slot left for insertion.
+    size_t required = 0;
+    for (const auto& entry : slots_)
+        if (entry.key)
+            required = std::max(static_cast<size_t>(entry.hash >> shift), required) + 1;
+    while (buckets + overflow_ <= required)
+        overflow_ *= 2;
+
+    std::vector<Entry> old(buckets + overflow_);
+    old.swap(slots_);
+    buckets_ = buckets;
+    shift_ = shift;
+
+    size_t last = 0;
+    for (auto& entry : old) {
+        if (entry.key) {
+            const size_t pos = std::max(home(entry.hash), last);
+            slots_[pos] = std::move(entry);
+            last = pos + 1;
+        }
+    }
+}
+
+} // effil
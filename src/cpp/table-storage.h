@@ -0,0 +1,112 @@
+#pragma once
+
+#include "stored-object.h"
+
+#include <vector>
+#include <cstdint>
+
+namespace effil {
+
+// Key-value storage of the shared table.
+//
+// Positive integer keys 1..N live in the array part, like in Lua tables.
+// The array part may contain holes left by removed keys.
+// Keys which are not able to get into the array part are stored
+// in the hash part: an open addressing hash table with linear probing
+// where slots are kept sorted by key hash (ordered hash table).
+// Iteration order depends only on indices and hashes,
+// so it's stable across rehashes and the next key can be found even when
+// the previous one has been removed during iteration.
+class TableStorage {
+public:
+    struct Entry {
+        uint64_t hash;
+        StoredObject key;
+        StoredObject value;
+    };
+
+    // Iteration is performed over positions:
+    // [0, arraySize) is the array part and the rest is the hash part.
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+public:
+    TableStorage();
+
+    // Returns pointer to the value stored under the key or nullptr
+    const StoredObject* find(const StoredKeyView& key) const;
+    StoredObject* find(const StoredKeyView& key) {
+        return const_cast<StoredObject*>(static_cast<const TableStorage*>(this)->find(key));
+    }
+    const StoredObject* findIndex(size_t index) const;
+
+    // Inserts a new entry or replaces the value of existing one.
+    // Returns the replaced value or nullptr if the key is new.
+    StoredObject set(StoredObject&& key, StoredObject&& value);
+
+    // Removes the entry and returns it. Key of returned entry is nullptr if there were no such key.
+    Entry erase(const StoredObject& key);
+
+    // Position of the entry which follows the key in iteration order.
+    // The key itself is not obligatory to be present in table.
+    size_t next(const StoredKeyView& key) const;
+    size_t next(size_t position) const { return seek(position + 1); }
+    size_t first() const { return seek(0); }
+
+    // Key of array position is its index + 1
+    bool isArrayPosition(size_t position) const { return position < array_.size(); }
+    StoredObject keyAt(size_t position) const;
+    const StoredObject& valueAt(size_t position) const;
+
+    size_t size() const { return arrayCount_ + size_; }
+    bool empty() const { return size() == 0; }
+
+    // Number of consecutive integer keys starting from 1
+    size_t length() const { return border_; }
+
+    // Bytes allocated for entries and held by their keys and values
+    size_t memory() const {
+        return array_.capacity() * sizeof(StoredObject) + slots_.capacity() * sizeof(Entry) + heldMemory_;
+    }
+
+    static uint64_t hashOf(const StoredKeyView& key);
+
+    // Releases unused memory. Positions of entries are changed.
+    void compact();
+
+    // Preallocates memory for the array part and entries of the hash part.
+    // Positions of entries are changed.
+    void reserve(size_t arraySize, size_t hashSize);
+
+private:
+
+    StoredObject insert(StoredObject&& key, StoredObject&& value);
+    Entry remove(const StoredObject& key);
+    size_t arrayIndex(const StoredKeyView& key) const;
+    void migrateToArray();
+    void shrinkArray();
+    size_t seek(size_t position) const;
+
+    size_t home(uint64_t hash) const { return static_cast<size_t>(hash >> shift_); }
+    size_t lowerBound(uint64_t hash, const StoredKeyView& key, bool& found) const;
+    StoredObject hashSet(StoredObject&& key, StoredObject&& value);
+    Entry hashErase(const StoredObject& key);
+    void rehash(size_t buckets);
+
+private:
+    // array part
+    std::vector<StoredObject> array_;
+    size_t arrayCount_;
+    size_t border_;
+
+    // hash part
+    std::vector<Entry> slots_;
+    size_t buckets_;
+    size_t overflow_;
+    unsigned shift_;
+    size_t size_;
+
+    // Memory held by stored keys and values, updated on modification
+    size_t heldMemory_;
+};
+
+} // effil
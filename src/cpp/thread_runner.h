@@ -12,7 +12,7 @@ public:
     StoredObject function_;
 };
 
-struct ThreadRunner: public GCObject<ThreadRunnerData> {
+struct ThreadRunner: public GCObject<ThreadRunnerData, GCObjectType::ThreadRunner> {
     static void exportAPI(sol::state_view& lua);
 
     std::string getPath() const { return ctx_->path_; }
@@ -167,6 +167,17 @@ void ThreadHandle::changeStatus(Status stat) {
         completionNotifier_.notify();
 }
 
+size_t ThreadHandle::memory() const {
+    size_t total = sizeof(ThreadHandle) + referencesMemory();
+    std::unique_lock<std::mutex> lock(stateLock_);
+    if (isFinishStatus(status_)) {
+        total += result_.capacity() * sizeof(StoredObject);
+        for (const auto& value : result_)
+            total += value.memory();
+    }
+    return total;
+}
+
 void Thread::runThread(Thread thread,
                Function function,
                effil::StoredArray arguments) {
@@ -204,10 +215,10 @@ void Thread::runThread(Thread thread,
             sol::variadic_args args(thread.ctx_->lua(), -lua_gettop(thread.ctx_->lua()));
             for (const auto& iter : args) {
                 StoredObject store = createStoredObject(iter.get<sol::object>());
-                if (store->gcHandle() != nullptr)
+                if (store.gcHandle() != nullptr)
                 {
-                    thread.ctx_->addReference(store->gcHandle());
-                    store->releaseStrongReference();
+                    thread.ctx_->addReference(store.gcHandle());
+                    store.releaseStrongReference();
                 }
                 thread.ctx_->result().emplace_back(std::move(store));
             }
@@ -251,9 +262,9 @@ void Thread::initialize(
     effil::StoredArray arguments;
     try {
         for (const auto& arg : variadicArgs) {
-            const auto& storedObj = createStoredObject(arg.get<sol::object>());
-            ctx_->addReference(storedObj->gcHandle());
-            storedObj->releaseStrongReference();
+            auto storedObj = createStoredObject(arg.get<sol::object>());
+            ctx_->addReference(storedObj.gcHandle());
+            storedObj.releaseStrongReference();
             arguments.emplace_back(storedObj);
         }
     } RETHROW_WITH_PREFIX("effil.thread");
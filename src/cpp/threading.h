@@ -70,6 +70,9 @@ public:
 
     StoredArray& result() { return result_; }
 
+    // Results are counted only when the thread is finished
+    size_t memory() const override;
+
     void setNotifier(IInterruptable* notifier) {
         currNotifier_ = notifier;
     }
@@ -86,13 +89,13 @@ private:
     Notifier statusNotifier_;
     Notifier commandNotifier_;
     Notifier completionNotifier_;
-    std::mutex stateLock_;
+    mutable std::mutex stateLock_;
     StoredArray result_;
     IInterruptable* currNotifier_;
     std::unique_ptr<sol::state> lua_;
 };
 
-class Thread : public GCObject<ThreadHandle> {
+class Thread : public GCObject<ThreadHandle, GCObjectType::Thread> {
 public:
     static void exportAPI(sol::state_view& lua);
 
@@ -0,0 +1,193 @@
+require "bootstrap-tests"
+
+test.array.tear_down = default_tear_down
+
+test.array.constructor = function ()
+    local arr = effil.array("double", 10)
+    test.equal(#arr, 10)
+    test.equal(effil.size(arr), 10)
+    test.equal(arr[1], 0)
+    test.equal(arr[10], 0)
+
+    arr = effil.array("int64", { 1, 2, 3 })
+    test.equal(#arr, 3)
+    test.equal(arr[3], 3)
+    test.equal(#effil.array("uint8", 0), 0)
+
+    test.equal(pcall(effil.array, "int32", 10), false)
+    test.equal(pcall(effil.array, 1, 10), false)
+    test.equal(pcall(effil.array, "double", -1), false)
+    test.equal(pcall(effil.array, "double", 1.5), false)
+    test.equal(pcall(effil.array, "double", "10"), false)
+    test.equal(pcall(effil.array, "uint8", { 1, 1000 }), false)
+end
+
+test.array.element_types = function ()
+    local doubles = effil.array("double", 1)
+    doubles[1] = 0.1
+    test.equal(doubles[1], 0.1)
+
+    local floats = effil.array("float", 1)
+    floats[1] = 0.5
+    test.equal(floats[1], 0.5)
+
+    local integers = effil.array("int64", 1)
+    integers[1] = -2^40
+    test.equal(integers[1], -2^40)
+    test.equal(pcall(function() integers[1] = 0.5 end), false)
+    test.equal(pcall(function() integers[1] = 2^63 end), false)
+
+    local bytes = effil.array("uint8", 1)
+    bytes[1] = 255
+    test.equal(bytes[1], 255)
+    test.equal(pcall(function() bytes[1] = 256 end), false)
+    test.equal(pcall(function() bytes[1] = -1 end), false)
+    test.equal(pcall(function() bytes[1] = "1" end), false)
+    test.equal(bytes[1], 255)
+end
+
+test.array.bounds = function ()
+    local arr = effil.array("double", 3)
+    test.equal(pcall(function() return arr[0] end), false)
+    test.equal(pcall(function() return arr[4] end), false)
+    test.equal(pcall(function() return arr[1.5] end), false)
+    test.equal(pcall(function() return arr.key end), false)
+    test.equal(pcall(function() arr[4] = 1 end), false)
+
+    local ok, err = pcall(function() return arr[4] end)
+    test.is_false(ok)
+    test.is_not_nil(string.find(err, "out of range"))
+end
+
+test.array.sharing = function ()
+    local arr = effil.array("double", 100)
+    local share = effil.table { samples = arr }
+    test.equal(effil.type(share.samples), "effil.array")
+    share.samples[1] = 1
+    test.equal(arr[1], 1)
+    test.equal(effil.dump(share).samples[1], 1)
+
+    local chan = effil.channel()
+    chan:push(arr)
+    chan:pop()[2] = 2
+    test.equal(arr[2], 2)
+
+    local worker = effil.thread(function(samples, from, to)
+        for i = from, to do
+            samples[i] = i * 0.5
+        end
+    end)
+    local threads = {}
+    for id = 1, 4 do
+        threads[id] = worker(arr, (id - 1) * 25 + 1, id * 25)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+
+    local dumped = effil.dump(arr)
+    test.equal(type(dumped), "table")
+    test.equal(#dumped, 100)
+    for i = 1, 100 do
+        test.equal(dumped[i], i * 0.5)
+    end
+end
+
+test.array.kernels = function ()
+    -- sizes are chosen to cover both vectorized part and the tail
+    local x = effil.array("double", 1003)
+    local y = effil.array("double", 1003)
+    for i = 1, #x do
+        x[i] = i
+        y[i] = 2
+    end
+    test.equal(effil.sum(x), 1003 * 1004 / 2)
+    test.equal(effil.dot(x, y), 1003 * 1004)
+    test.equal(effil.dot(x, x), 1003 * 1004 * 2007 / 6)
+    local min, max = effil.minmax(x)
+    test.equal(min, 1)
+    test.equal(max, 1003)
+
+    test.equal(effil.axpy(0.5, x, y), y)
+    test.equal(y[1], 2.5)
+    test.equal(y[1003], 503.5)
+    effil.scale(y, 2)
+    test.equal(y[1003], 1007)
+
+    local floats = effil.array("float", { 1, -2.5, 4, 0.5, 3 })
+    test.equal(effil.sum(floats), 6)
+    min, max = effil.minmax(floats)
+    test.equal(min, -2.5)
+    test.equal(max, 4)
+
+    local bytes = effil.fill(effil.array("uint8", 17), 200)
+    test.equal(effil.sum(bytes), 17 * 200)
+    test.equal(bytes[17], 200)
+    test.equal(pcall(effil.fill, bytes, 256), false)
+    test.equal(pcall(effil.scale, bytes, 2), false)
+
+    min, max = effil.minmax(effil.array("int64", 0))
+    test.is_nil(min)
+    test.is_nil(max)
+
+    test.equal(pcall(effil.sum, effil.table()), false)
+    test.equal(pcall(effil.dot, x, floats), false)
+    test.equal(pcall(effil.dot, x, effil.array("double", 10)), false)
+    test.equal(pcall(effil.axpy, "2", x, y), false)
+end
+
+test.array.minmax_nan = function ()
+    for _, type in ipairs { "double", "float" } do
+        -- NaN in vectorized part, in the tail and in the first element
+        for _, position in ipairs { 1, 5, 37 } do
+            local arr = effil.array(type, 37)
+            for i = 1, #arr do
+                arr[i] = i - 10
+            end
+            arr[position] = 0 / 0
+            local min, max = effil.minmax(arr)
+            test.not_equal(min, min)
+            test.not_equal(max, max)
+        end
+    end
+end
+
+test.array.copy_range = function ()
+    local src = effil.array("int64", { 1, 2, 3, 4, 5 })
+    local dst = effil.array("int64", 5)
+    test.equal(effil.copy_range(dst, 2, src, 1, 3), dst)
+    test.equal(dst[1], 0)
+    test.equal(dst[2], 1)
+    test.equal(dst[4], 3)
+    test.equal(dst[5], 0)
+
+    -- overlapping ranges
+    effil.copy_range(src, 2, src, 1, 4)
+    test.equal(src[1], 1)
+    test.equal(src[2], 1)
+    test.equal(src[5], 4)
+
+    test.equal(pcall(effil.copy_range, dst, 4, src, 1, 3), false)
+    test.equal(pcall(effil.copy_range, dst, 0, src, 1, 1), false)
+    test.equal(pcall(effil.copy_range, effil.array("double", 5), 1, src, 1, 1), false)
+end
+
+test.array.concurrent_axpy = function ()
+    local x = effil.fill(effil.array("double", 1000), 1)
+    local y = effil.array("double", 1000)
+    local worker = effil.thread(function(x, y, count)
+        local effil = require "effil"
+        for _ = 1, count do
+            effil.axpy(1, x, y)
+        end
+    end)
+
+    local threads = {}
+    for id = 1, 4 do
+        threads[id] = worker(x, y, 100)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(effil.sum(y), 400 * 1000)
+end
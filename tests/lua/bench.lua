@@ -0,0 +1,444 @@
+require "bootstrap-tests"
+
+-- Benchmarks are not checking anything, they only print timings.
+-- Run them with BENCH=<scale> environment variable.
+-- Timings are measured in process CPU time, so for multithreaded cases
+-- they also include time spent by threads waiting for locks.
+
+test.bench.tear_down = default_tear_down
+
+local scale = tonumber(os.getenv("BENCH")) or 1
+
+local function measure(name, count, func)
+    local start = os.clock()
+    func()
+    local elapsed = os.clock() - start
+    print(string.format("  %-40s %10.3f s  %12.0f ops/s", name, elapsed, count / math.max(elapsed, 1e-9)))
+    return elapsed
+end
+
+test.bench.shared_table_string_keys = function ()
+    local count = 100000 * scale
+    local keys = {}
+    for i = 1, count do
+        keys[i] = "key_" .. i
+    end
+
+    local share = effil.table()
+    measure("effil.table set (string keys)", count, function()
+        for i = 1, count do
+            share[keys[i]] = i
+        end
+    end)
+    measure("effil.table get (string keys)", count, function()
+        for i = 1, count do
+            local _ = share[keys[i]]
+        end
+    end)
+    measure("effil.table get missing (string keys)", count, function()
+        for i = 1, count do
+            local _ = share["missing_" .. i]
+        end
+    end)
+    measure("effil.pairs", count, function()
+        for _, _ in effil.pairs(share) do end
+    end)
+    measure("effil.table remove (string keys)", count, function()
+        for i = 1, count do
+            share[keys[i]] = nil
+        end
+    end)
+end
+
+test.bench.shared_table_number_keys = function ()
+    local count = 100000 * scale
+    local share = effil.table()
+    measure("effil.table set (number keys)", count, function()
+        for i = 1, count do
+            share[i * 7.5] = i
+        end
+    end)
+    measure("effil.table get (number keys)", count, function()
+        for i = 1, count do
+            local _ = share[i * 7.5]
+        end
+    end)
+end
+
+test.bench.channel_primitives = function ()
+    local count = 100000 * scale
+    local chan = effil.channel()
+    measure("channel push/pop of numbers and booleans", count, function()
+        for i = 1, count do
+            chan:push(i, i * 0.5, true, nil)
+            chan:pop()
+        end
+    end)
+end
+
+test.bench.channel_concurrent_messages = function ()
+    local count = 20000 * scale
+    local threads_count = 8
+    local chan = effil.channel()
+    local producer = effil.thread(function(chan, count)
+        for i = 1, count do
+            chan:push(i, "message", { id = i })
+        end
+    end)
+    local consumer = effil.thread(function(chan, count)
+        for _ = 1, count do
+            chan:pop()
+        end
+    end)
+
+    local before = effil.allocator_stats()
+    measure("concurrent channel messages, threads = " .. threads_count * 2, count * threads_count, function()
+        local threads = {}
+        for i = 1, threads_count do
+            threads[#threads + 1] = producer(chan, count)
+            threads[#threads + 1] = consumer(chan, count)
+        end
+        for _, thr in ipairs(threads) do
+            thr:wait()
+        end
+    end)
+    local after = effil.allocator_stats()
+    local allocations = after.allocations - before.allocations
+    print(string.format("  allocator: %d allocations, hit rate %.1f%%, %d slabs", allocations,
+        100 * (after.hits - before.hits) / math.max(allocations, 1), after.slabs - before.slabs))
+end
+
+test.bench.shared_table_array = function ()
+    local count = 20000 * scale
+    local share = effil.table()
+    measure("effil.table append with #", count, function()
+        for i = 1, count do
+            share[#share + 1] = i
+        end
+    end)
+    measure("effil.ipairs", count, function()
+        for _, _ in effil.ipairs(share) do end
+    end)
+    measure("effil.table indexed get", count, function()
+        for i = 1, count do
+            local _ = share[i]
+        end
+    end)
+    measure("effil.table pop with #", count, function()
+        for i = 1, count do
+            share[#share] = nil
+        end
+    end)
+end
+
+test.bench.shared_table_concurrent_writes = function ()
+    local threads_count = 8
+    local count = 20000 * scale
+    local worker = effil.thread(function(tbl, id, count)
+        for i = 1, count do
+            tbl[id * count + i] = i
+        end
+    end)
+
+    for _, shards in ipairs({1, 4, 16}) do
+        local share = effil.table(nil, { shards = shards })
+        local threads = {}
+        measure("concurrent writes, shards = " .. shards, count * threads_count, function()
+            for id = 1, threads_count do
+                threads[id] = worker(share, id, count)
+            end
+            for _, thr in ipairs(threads) do
+                thr:wait()
+            end
+        end)
+    end
+end
+
+test.bench.shared_table_concurrent_reads = function ()
+    local threads_count = 8
+    local count = 100000 * scale
+    local share = effil.table { config = "value" }
+    local worker = effil.thread(function(tbl, count)
+        for _ = 1, count do
+            local _ = tbl.config
+        end
+    end)
+
+    local threads = {}
+    measure("concurrent reads", count * threads_count, function()
+        for id = 1, threads_count do
+            threads[id] = worker(share, count)
+        end
+        for _, thr in ipairs(threads) do
+            thr:wait()
+        end
+    end)
+end
+
+test.bench.shared_table_with_metatable = function ()
+    local count = 100000 * scale
+    local class = effil.table { method = function() end }
+    class.__index = class
+    local object = effil.setmetatable(effil.table { field = 1 }, class)
+    local plain = effil.setmetatable(effil.table { field = 1 }, effil.table())
+
+    measure("field get with metatable", count, function()
+        for _ = 1, count do
+            local _ = object.field
+        end
+    end)
+    measure("missing field get with metatable", count, function()
+        for _ = 1, count do
+            local _ = plain.missing
+        end
+    end)
+    measure("method get via __index table", count, function()
+        for _ = 1, count do
+            local _ = object.method
+        end
+    end)
+end
+
+test.bench.shared_table_bulk = function ()
+    local count = 10000 * scale
+    local record = {}
+    local keys = {}
+    for i = 1, 30 do
+        record["field" .. i] = i
+        keys[i] = "field" .. i
+    end
+
+    local share = effil.table()
+    measure("set 30 fields one by one", count, function()
+        for _ = 1, count do
+            for k, v in pairs(record) do
+                share[k] = v
+            end
+        end
+    end)
+    measure("effil.set_many 30 fields", count, function()
+        for _ = 1, count do
+            effil.set_many(share, record)
+        end
+    end)
+    measure("effil.get_many 30 fields", count, function()
+        for _ = 1, count do
+            effil.get_many(share, keys)
+        end
+    end)
+end
+
+test.bench.shared_table_counter = function ()
+    local count = 100000 * scale
+    local share = effil.table { counter = 0 }
+    measure("increment with get and set", count, function()
+        for _ = 1, count do
+            share.counter = share.counter + 1
+        end
+    end)
+    measure("effil.atomic_add", count, function()
+        for _ = 1, count do
+            effil.atomic_add(share, "counter", 1)
+        end
+    end)
+end
+
+test.bench.shared_table_frozen = function ()
+    local threads_count = 8
+    local count = 100000 * scale
+    local worker = effil.thread(function(tbl, count)
+        for _ = 1, count do
+            local _ = tbl.config
+        end
+    end)
+
+    for _, frozen in ipairs({false, true}) do
+        local share = effil.table { config = "value" }
+        if frozen then
+            effil.freeze(share)
+        end
+        local threads = {}
+        measure("concurrent reads, frozen = " .. tostring(frozen), count * threads_count, function()
+            for id = 1, threads_count do
+                threads[id] = worker(share, count)
+            end
+            for _, thr in ipairs(threads) do
+                thr:wait()
+            end
+        end)
+    end
+end
+
+test.bench.array_elements = function ()
+    local count = 100000 * scale
+    local share = effil.table()
+    local arr = effil.array("double", count)
+    measure("effil.table element writes", count, function()
+        for i = 1, count do
+            share[i] = i * 0.5
+        end
+    end)
+    measure("effil.array element writes", count, function()
+        for i = 1, count do
+            arr[i] = i * 0.5
+        end
+    end)
+end
+
+test.bench.array_kernels = function ()
+    local size = 100000
+    local count = 10 * scale
+    local x = effil.fill(effil.array("double", size), 0.5)
+    local y = effil.fill(effil.array("double", size), 2)
+
+    measure("Lua loop sum", size * count, function()
+        for _ = 1, count do
+            local sum = 0
+            for i = 1, size do
+                sum = sum + x[i]
+            end
+        end
+    end)
+    measure("effil.sum", size * count, function()
+        for _ = 1, count do
+            effil.sum(x)
+        end
+    end)
+    measure("Lua loop dot", size * count, function()
+        for _ = 1, count do
+            local sum = 0
+            for i = 1, size do
+                sum = sum + x[i] * y[i]
+            end
+        end
+    end)
+    measure("effil.dot", size * count, function()
+        for _ = 1, count do
+            effil.dot(x, y)
+        end
+    end)
+    measure("Lua loop axpy", size * count, function()
+        for _ = 1, count do
+            for i = 1, size do
+                y[i] = 0.5 * x[i] + y[i]
+            end
+        end
+    end)
+    measure("effil.axpy", size * count, function()
+        for _ = 1, count do
+            effil.axpy(0.5, x, y)
+        end
+    end)
+end
+
+test.bench.nested_tables_conversion = function ()
+    local count = 20000 * scale
+    local source = {}
+    for i = 1, count do
+        source[i] = { id = i, nested = { value = i } }
+    end
+    measure("effil.table with nested tables", count * 2, function()
+        local _ = effil.table(source)
+    end)
+end
+
+test.bench.sequence_conversion = function ()
+    local count = 1000000 * scale
+    local source = {}
+    for i = 1, count do
+        source[i] = i
+    end
+    measure("effil.table from sequence", count, function()
+        local _ = effil.table(source)
+    end)
+end
+
+test.bench.dump = function ()
+    local count = 100000 * scale
+    local share = effil.table()
+    for i = 1, count do
+        share[i] = { id = i, name = "item" .. i }
+    end
+    measure("effil.dump of nested tables", count, function()
+        local _ = effil.dump(share)
+    end)
+end
+
+test.bench.snapshot = function ()
+    local count = 100000 * scale
+    local share = effil.table()
+    for i = 1, count do
+        share[i] = { id = i, name = "item" .. i }
+    end
+    local path = os.tmpname()
+    measure("effil.save of nested tables", count, function()
+        effil.save(share, path)
+    end)
+    measure("effil.load of nested tables", count, function()
+        local _ = effil.load(path)
+    end)
+    os.remove(path)
+end
+
+test.bench.mmap_table = function ()
+    local count = 100000 * scale
+    local source = {}
+    for i = 1, count do
+        source["key_" .. i] = { id = i }
+    end
+    local path = os.tmpname()
+    effil.mmap_table(path, source)
+
+    measure("effil.mmap_table open", 1, function()
+        local _ = effil.mmap_table(path)
+    end)
+    local tbl = effil.mmap_table(path)
+    measure("effil.mmap_table lookup", count, function()
+        for i = 1, count do
+            local _ = tbl["key_" .. i]
+        end
+    end)
+    os.remove(path)
+end
+
+test.bench.range = function ()
+    local count = 100000 * scale
+    local share = effil.table()
+    -- sparse timestamps with milliseconds, all of them get into the hash part
+    local start = 1700000000
+    for i = 1, count do
+        share[start + i * 10 + (i % 1000) / 1000] = i
+    end
+    local windows = 100
+    local low, high = start + count * 5, start + count * 5 + 100
+
+    local scan = measure("effil.pairs filtered by key range", 1, function()
+        for key, _ in effil.pairs(share) do
+            if key >= low and key <= high then end
+        end
+    end)
+    -- the first call builds the index
+    for _, _ in effil.range(share, low, high) do end
+    local lookup = measure("effil.range over 10 keys", windows, function()
+        for _ = 1, windows do
+            for _, _ in effil.range(share, low, high) do end
+        end
+    end)
+    -- window lookups don't touch entries out of range
+    test.is_true(lookup < scan)
+end
+
+test.bench.cache = function ()
+    local count = 1000000 * scale
+    local cache = effil.cache { capacity = 10000 }
+    measure("effil.cache put with eviction", count, function()
+        for i = 1, count do
+            cache:put(i, i)
+        end
+    end)
+    measure("effil.cache get", count, function()
+        for i = 1, count do
+            local _ = cache:get(i)
+        end
+    end)
+end
@@ -0,0 +1,132 @@
+require "bootstrap-tests"
+
+test.cache.tear_down = default_tear_down
+
+test.cache.get_put = function ()
+    local cache = effil.cache()
+    test.is_nil(cache:get("key"))
+    cache:put("key", "value")
+    cache:put(1, 2.5)
+    cache:put(true, false)
+    test.equal(cache:get("key"), "value")
+    test.equal(cache:get(1), 2.5)
+    test.equal(cache:get(true), false)
+    test.equal(cache:size(), 3)
+    test.equal(effil.size(cache), 3)
+
+    cache:put("key", "new value")
+    test.equal(cache:get("key"), "new value")
+    test.equal(cache:size(), 3)
+
+    cache:put("key", nil)
+    test.is_nil(cache:get("key"))
+    cache:remove(1)
+    test.is_nil(cache:get(1))
+    test.equal(cache:size(), 1)
+
+    cache:clear()
+    test.equal(cache:size(), 0)
+    test.is_nil(cache:get(true))
+
+    test.equal(pcall(cache.get, cache, nil), false)
+    test.equal(pcall(cache.put, cache, nil, 1), false)
+end
+
+test.cache.lru_eviction = function ()
+    local cache = effil.cache { capacity = 3 }
+    cache:put(1, "one")
+    cache:put(2, "two")
+    cache:put(3, "three")
+    -- 1 becomes the most recently used one
+    test.equal(cache:get(1), "one")
+    cache:put(4, "four")
+    test.equal(cache:size(), 3)
+    test.is_nil(cache:get(2))
+    test.equal(cache:get(1), "one")
+    test.equal(cache:get(3), "three")
+    test.equal(cache:get(4), "four")
+
+    -- update makes the entry recently used too
+    cache:put(1, "uno")
+    cache:put(5, "five")
+    test.is_nil(cache:get(3))
+    test.equal(cache:get(1), "uno")
+end
+
+test.cache.expiration = function ()
+    local cache = effil.cache { ttl = 100 }
+    cache:put("first", 1)
+    effil.sleep(60, "ms")
+    cache:put("second", 2)
+    -- get doesn't prolong time to live
+    test.equal(cache:get("first"), 1)
+    effil.sleep(60, "ms")
+    test.is_nil(cache:get("first"))
+    test.equal(cache:get("second"), 2)
+    test.equal(cache:size(), 1)
+
+    -- put does
+    cache:put("second", 3)
+    effil.sleep(60, "ms")
+    test.equal(cache:get("second"), 3)
+    effil.sleep(60, "ms")
+    test.equal(cache:size(), 0)
+end
+
+test.cache.shared_between_threads = function ()
+    local cache = effil.cache { capacity = 100 }
+    local nested = effil.table { value = "nested" }
+    cache:put("table", nested)
+
+    local thr = effil.thread(function(cache, count)
+        for i = 1, count do
+            cache:put(i, i * i)
+        end
+        return cache:get("table").value
+    end)(cache, 1000)
+    test.equal(thr:get(), "nested")
+    test.equal(cache:size(), 100)
+    test.equal(cache:get(1000), 1000 * 1000)
+
+    local share = effil.table { cache = cache }
+    test.equal(effil.type(share.cache), "effil.cache")
+    test.equal(share.cache:get(1000), 1000 * 1000)
+end
+
+test.cache.gc_references = function ()
+    collectgarbage()
+    effil.gc.collect()
+    local initial = effil.gc.count()
+
+    local cache = effil.cache { capacity = 2 }
+    cache:put("a", effil.table())
+    cache:put(effil.table(), "key is a table")
+    collectgarbage()
+    effil.gc.collect()
+    -- cache and both tables are alive
+    test.equal(effil.gc.count(), initial + 3)
+
+    cache:put("b", 1)
+    cache:put("c", 2)
+    collectgarbage()
+    effil.gc.collect()
+    test.equal(effil.gc.count(), initial + 1)
+end
+
+test.cache.wrong_options = function ()
+    test.equal(pcall(effil.cache, 1), false)
+    test.equal(pcall(effil.cache, { capacity = "1" }), false)
+    test.equal(pcall(effil.cache, { capacity = -1 }), false)
+    test.equal(pcall(effil.cache, { ttl = -1 }), false)
+end
+
+test.cache.bounded_memory = function ()
+    local cache = effil.cache { capacity = 10 }
+    local empty = effil.memory(cache)
+    for i = 1, 1000 do
+        cache:put(i, string.rep("x", 1000) .. i)
+    end
+    local full = effil.memory(cache)
+    test.is_true(full >= empty + 10 * 1000)
+    test.is_true(full < empty + 100 * 1000)
+end
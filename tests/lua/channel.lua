@@ -70,3 +70,32 @@ test.channel.with_shared_table = function ()
     table.channel:push(test_value)
     test.equal(table.channel:pop(), test_value)
 end
+
+test.channel.allocator_stats = function ()
+    local before = effil.allocator_stats()
+    local chan = effil.channel()
+    local consumer = effil.thread(function(chan, count)
+        for _ = 1, count do
+            local value, text = chan:pop()
+            if value == nil or text ~= "message" .. value then
+                return false
+            end
+        end
+        return true
+    end)(chan, 10000)
+
+    for i = 1, 10000 do
+        chan:push(i, "message" .. i)
+    end
+    test.equal(consumer:get(), true)
+    test.equal(chan:size(), 0)
+
+    -- counters of this thread are published at least every 1024 allocations
+    local after = effil.allocator_stats()
+    for _, name in ipairs { "allocations", "hits", "refills", "slabs", "large" } do
+        test.equal(type(after[name]), "number")
+        test.is_true(after[name] >= before[name])
+    end
+    test.is_true(after.allocations > before.allocations)
+    test.is_true(after.hits <= after.allocations)
+end
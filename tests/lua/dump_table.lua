@@ -101,3 +101,41 @@ test.dump_table.with_metatable = function()
     test.not_equal(mt2, nil)
     test.equal(mt2.b, 2)
 end
+
+test.dump_table.deep_nesting = function()
+    local share = effil.table()
+    local current = share
+    for i = 1, 10000 do
+        current.next = effil.table { level = i }
+        current = current.next
+    end
+
+    local result = effil.dump(share)
+    local depth = 0
+    current = result.next
+    while current do
+        depth = depth + 1
+        test.equal(current.level, depth)
+        current = current.next
+    end
+    test.equal(depth, 10000)
+end
+
+test.dump_table.shared_subtables = function()
+    local common = effil.table { value = "common" }
+    local share = effil.table(nil, { shards = 4 })
+    for i = 1, 100 do
+        share[i] = { id = i, common = common }
+    end
+    share.first = common
+    share.second = common
+
+    local result = effil.dump(share)
+    test.equal(type(result.first), "table")
+    test.equal(result.first, result.second)
+    test.equal(result.first.value, "common")
+    for i = 1, 100 do
+        test.equal(result[i].id, i)
+        test.equal(result[i].common, result.first)
+    end
+end
@@ -119,3 +119,49 @@ test.gc.check_step = function()
     fabric:create(1) -- trigger GC
     test.equal(gc.count(), 251)
 end
+
+test.gc.memory_of_objects = function()
+    local value = string.rep("x", 1000)
+
+    local tbl = effil.table()
+    local empty = effil.memory(tbl)
+    for i = 1, 100 do
+        tbl[i] = value .. i
+    end
+    local full = effil.memory(tbl)
+    test.is_true(full >= empty + 100 * 1000)
+    for i = 1, 100 do
+        tbl[i] = nil
+    end
+    test.is_true(effil.memory(tbl) < full - 100 * 1000)
+
+    local chan = effil.channel()
+    empty = effil.memory(chan)
+    chan:push(value, value)
+    test.is_true(effil.memory(chan) >= empty + 2 * 1000)
+    chan:pop()
+    test.equal(effil.memory(chan), empty)
+
+    test.is_true(effil.memory(effil.array("double", 1000)) >= 8 * 1000)
+
+    local thr = effil.thread(function() return value end)()
+    thr:wait()
+    test.is_true(effil.memory(thr) >= 1000)
+
+    test.equal(pcall(effil.memory, {}), false)
+    test.equal(pcall(effil.memory, value), false)
+end
+
+test.gc.memory_total = function()
+    collectgarbage()
+    gc.collect()
+    local initial = gc.memory()
+
+    local tbl = effil.table { string.rep("x", 100000) }
+    test.is_true(gc.memory() >= initial + 100000)
+
+    tbl = nil
+    collectgarbage()
+    gc.collect()
+    test.is_true(gc.memory() < initial + 100000)
+end
@@ -260,3 +260,35 @@ test.shared_table_with_metatable.next_iterator = function()
     end
     test.is_true(next(visited) == nil) -- table is empty
 end
+
+test.shared_table_with_metatable.metatable_modification = function()
+    local mt = effil.table()
+    local share = effil.setmetatable(effil.table(), mt)
+    test.equal(share.key, nil)
+    test.equal(tostring(share):find("effil.table: "), 1)
+
+    mt.__index = function(_, key) return "mt_" .. key end
+    mt.__tostring = function() return "shared" end
+    test.equal(share.key, "mt_key")
+    test.equal(tostring(share), "shared")
+
+    mt.__index = effil.table { key = "value" }
+    test.equal(share.key, "value")
+
+    mt.__index = nil
+    effil.rawset(mt, "__tostring", nil)
+    test.equal(share.key, nil)
+    test.equal(tostring(share):find("effil.table: "), 1)
+end
+
+test.shared_table_with_metatable.sharded_metatable = function()
+    local mt = effil.table(nil, { shards = 8 })
+    local share = effil.setmetatable(effil.table(), mt)
+    mt.__len = function() return 42 end
+    mt.__call = function(_, arg) return arg * 2 end
+    test.equal(#share, 42)
+    test.equal(share(21), 42)
+
+    mt.__len = nil
+    test.equal(#share, 0)
+end
@@ -0,0 +1,121 @@
+require "bootstrap-tests"
+
+local mapped_path = os.tmpname()
+
+test.mmap_table.tear_down = function ()
+    os.remove(mapped_path)
+    default_tear_down()
+end
+
+test.mmap_table.lookup = function ()
+    effil.mmap_table(mapped_path, {
+        "one", "two", 3, 4.5, true,
+        key = "value", [false] = 0, [-1] = "negative", [0.5] = "half",
+        ["with\0zero"] = "binary\0string"
+    })
+    local tbl = effil.mmap_table(mapped_path)
+    test.equal(effil.type(tbl), "effil.mmap_table")
+    test.equal(#tbl, 5)
+    test.equal(effil.size(tbl), 10)
+    test.equal(tbl[1], "one")
+    test.equal(tbl[2.0], "two")
+    test.equal(tbl[3], 3)
+    test.equal(tbl[4], 4.5)
+    test.equal(tbl[5], true)
+    test.equal(tbl.key, "value")
+    test.equal(tbl[false], 0)
+    test.equal(tbl[-1], "negative")
+    test.equal(tbl[0.5], "half")
+    test.equal(tbl["with\0zero"], "binary\0string")
+    test.is_nil(tbl[6])
+    test.is_nil(tbl.missing)
+    test.is_nil(tbl[{}])
+end
+
+test.mmap_table.nested_tables = function ()
+    local shared = { value = 1 }
+    local source = { left = shared, right = shared, list = { 10, 20, 30 } }
+    source.self = source
+
+    local tbl = effil.mmap_table(mapped_path, source)
+    test.equal(tbl.left.value, 1)
+    test.equal(tbl.left, tbl.right)
+    test.equal(tbl.self, tbl)
+    test.equal(tbl.self.self.list[3], 30)
+    test.not_equal(tbl.left, tbl.list)
+end
+
+test.mmap_table.from_shared_table = function ()
+    local tbl = effil.mmap_table(mapped_path, effil.table { 1, 2, nested = { key = "value" } })
+    test.equal(#tbl, 2)
+    test.equal(tbl.nested.key, "value")
+end
+
+test.mmap_table.iteration = function ()
+    local source = { "a", "b", "c", x = 1, y = 2 }
+    local tbl = effil.mmap_table(mapped_path, source)
+
+    local count, last = 0, nil
+    for k, v in effil.pairs(tbl) do
+        test.equal(source[k], v)
+        count, last = count + 1, k
+    end
+    test.equal(count, 5)
+
+    count = 0
+    for i, v in effil.ipairs(tbl) do
+        test.equal(source[i], v)
+        count = count + 1
+    end
+    test.equal(count, 3)
+
+    test.equal(effil.next(tbl), 1)
+    test.is_nil(effil.next(tbl, last))
+    test.equal(pcall(effil.next, tbl, "missing"), false)
+end
+
+test.mmap_table.read_only = function ()
+    local tbl = effil.mmap_table(mapped_path, { key = "value" })
+    test.equal(pcall(function() tbl.key = "other" end), false)
+    test.equal(tbl.key, "value")
+end
+
+test.mmap_table.shared_between_threads = function ()
+    local tbl = effil.mmap_table(mapped_path, { data = { 1, 2, 3 } })
+    local share = effil.table { mapped = tbl }
+    test.equal(share.mapped, tbl)
+
+    local sum = effil.thread(function(mapped)
+        local result = 0
+        for i = 1, #mapped.data do
+            result = result + mapped.data[i]
+        end
+        return result
+    end)(tbl):get()
+    test.equal(sum, 6)
+end
+
+test.mmap_table.unsupported_values = function ()
+    test.equal(pcall(effil.mmap_table, 1), false)
+    test.equal(pcall(effil.mmap_table, mapped_path, 1), false)
+    test.equal(pcall(effil.mmap_table, mapped_path, { print }), false)
+    test.equal(pcall(effil.mmap_table, mapped_path, { [{}] = 1 }), false)
+    test.equal(pcall(effil.mmap_table, mapped_path .. ".missing"), false)
+end
+
+test.mmap_table.corrupted_file = function ()
+    effil.mmap_table(mapped_path, { "value", key = { 1, 2, 3 } })
+    local file = io.open(mapped_path, "rb")
+    local data = file:read("*a")
+    file:close()
+
+    file = io.open(mapped_path, "wb")
+    file:write(data:sub(1, #data - 8))
+    file:close()
+    test.equal(pcall(effil.mmap_table, mapped_path), false)
+
+    file = io.open(mapped_path, "wb")
+    file:write("not a mapped table at all, but long enough for the header")
+    file:close()
+    test.equal(pcall(effil.mmap_table, mapped_path), false)
+end
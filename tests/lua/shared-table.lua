@@ -59,6 +59,666 @@ test.shared_table.length = function ()
     test.equal(#share, 0)
 end
 
+test.shared_table.string_keys = function ()
+    local share = effil.table(nil, { shards = 4 })
+    local long = string.rep("long key ", 100)
+    share["a\0b"] = 1
+    share["a"] = 2
+    share[long] = 3
+    share["1"] = 4
+    share[1] = 5
+    share[""] = 6
+
+    test.equal(share["a\0b"], 1)
+    test.equal(share["a"], 2)
+    test.is_nil(share["a\0"])
+    test.equal(share[long], 3)
+    test.is_nil(share[long .. " "])
+    test.equal(share["1"], 4)
+    test.equal(share[1], 5)
+    test.equal(share[""], 6)
+    test.equal(effil.rawget(share, long), 3)
+    test.equal(effil.size(share), 6)
+end
+
+test.shared_table.string_interning = function ()
+    local share = effil.table()
+    for i = 1, 100 do
+        share[i] = { name = "record", id = "id" .. i % 10 }
+    end
+    test.equal(share[42].name, "record")
+    test.equal(share[42].id, "id2")
+
+    -- strings are released with the last holder and interned again
+    for i = 1, 100 do
+        share[i] = nil
+    end
+    collectgarbage()
+    effil.gc.collect()
+    share.name = "record"
+    test.equal(share.name, "record")
+
+    local worker = effil.thread(function(tbl)
+        for i = 1, 1000 do
+            tbl["key" .. i % 10] = "value" .. i % 10
+        end
+    end)
+    local threads = {}
+    for id = 1, 4 do
+        threads[id] = worker(share)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(share.key3, "value3")
+    test.equal(effil.size(share), 11)
+end
+
+test.shared_table.nested_tables_conversion = function ()
+    local common = { value = "common" }
+    local source = { first = common, second = common, items = {} }
+    source.self = source
+    for i = 1, 1000 do
+        source.items[i] = { id = i, parent = source, common = common }
+    end
+
+    local share = effil.table(source)
+    test.equal(share.self, share)
+    test.equal(share.first, share.second)
+    test.equal(share.items[500].id, 500)
+    test.equal(share.items[500].parent, share)
+    test.equal(share.items[1000].common, share.first)
+    test.equal(share.first.value, "common")
+end
+
+test.shared_table.sequence_conversion = function ()
+    local source = {}
+    for i = 1, 10000 do
+        source[i] = i * 2
+    end
+    source.name = "sequence"
+    source[10002] = "after hole"
+    source[2.5] = "float key"
+    source[-1] = "negative key"
+
+    local share = effil.table(source)
+    test.equal(#share, 10000)
+    test.equal(share[1], 2)
+    test.equal(share[10000], 20000)
+    test.equal(share.name, "sequence")
+    test.equal(share[10002], "after hole")
+    test.equal(share[2.5], "float key")
+    test.equal(share[-1], "negative key")
+    test.equal(effil.size(share), 10004)
+
+    local with_holes = effil.table { 1, 2, nil, 4, nil, nil, 7 }
+    test.equal(with_holes[4], 4)
+    test.equal(with_holes[7], 7)
+    test.is_nil(with_holes[3])
+    test.equal(effil.size(with_holes), 4)
+
+    local thr = effil.thread(function(tbl)
+        local sum = 0
+        for i = 1, #tbl do
+            sum = sum + tbl[i]
+        end
+        return sum
+    end)(source)
+    test.equal(thr:get(), 10000 * 10001)
+end
+
+test.shared_table.remove_while_iterating = function ()
+    local share = effil.table()
+    for i = 1, 1000 do
+        share["key" .. i] = i
+        share[i + 0.5] = i
+    end
+
+    local visited = 0
+    for k, _ in effil.pairs(share) do
+        share[k] = nil
+        visited = visited + 1
+    end
+    test.equal(visited, 2000)
+    test.equal(effil.size(share), 0)
+end
+
+test.shared_table.modify_while_iterating = function ()
+    local share = effil.table()
+    for i = 1, 100 do
+        share[i] = i
+        share["key" .. i] = i
+    end
+
+    local visited = {}
+    for k, v in effil.pairs(share) do
+        test.is_nil(visited[k])
+        visited[k] = v
+        share[k] = v * 2
+        if type(k) == "number" then
+            share[k + 1] = nil
+        end
+    end
+    for i = 1, 100, 2 do
+        test.equal(visited[i], i)
+        test.is_nil(visited[i + 1])
+        test.equal(visited["key" .. i], i)
+        test.equal(visited["key" .. i + 1], i + 1)
+    end
+
+    share = effil.table(nil, { shards = 4 })
+    for i = 1, 100 do
+        share["key" .. i] = i
+    end
+    local count = 0
+    for k, v in effil.pairs(share) do
+        share[k] = v * 2
+        count = count + 1
+    end
+    test.equal(count, 100)
+    test.equal(share.key50, 100)
+end
+
+test.shared_table.overwrite_references = function ()
+    local share = effil.table()
+    for i = 1, 10 do
+        share.key = effil.table()
+    end
+    share.key = nil
+    collectgarbage()
+    effil.gc.collect()
+    test.equal(effil.gc.count(), 2)
+end
+
+test.shared_table.array_part = function ()
+    local share = effil.table()
+    for i = 1000, 1, -1 do
+        share[i] = i
+    end
+    test.equal(#share, 1000)
+
+    local count = 0
+    for i, v in effil.ipairs(share) do
+        test.equal(i, v)
+        count = count + 1
+    end
+    test.equal(count, 1000)
+
+    share[#share] = nil
+    test.equal(#share, 999)
+    share[500] = nil
+    test.equal(#share, 499)
+    test.equal(effil.size(share), 998)
+    share[500] = 500
+    test.equal(#share, 999)
+    share[1000] = 1000
+    share[1001] = 1001
+    test.equal(#share, 1001)
+end
+
+test.shared_table.sharded = function ()
+    local share = effil.table({ key = "value", 1, 2, 3 }, { shards = 8 })
+    test.equal(share.key, "value")
+    test.equal(#share, 3)
+
+    for i = 4, 1000 do
+        share[i] = i
+        share["key" .. i] = i
+    end
+    test.equal(#share, 1000)
+    test.equal(effil.size(share), 1998)
+
+    local count = 0
+    for k, v in effil.pairs(share) do
+        test.equal(share[k], v)
+        count = count + 1
+    end
+    test.equal(count, 1998)
+
+    share[500] = nil
+    test.equal(#share, 499)
+
+    test.equal(pcall(effil.table, nil, 1), false)
+    test.equal(pcall(effil.table, nil, { shards = 0 }), false)
+    test.equal(pcall(effil.table, nil, { shards = "8" }), false)
+end
+
+test.shared_table.sharded_concurrent_writes = function ()
+    local share = effil.table(nil, { shards = 16 })
+    local worker = effil.thread(function(tbl, id)
+        for i = 1, 1000 do
+            tbl[id .. "_" .. i] = i
+        end
+    end)
+
+    local threads = {}
+    for id = 1, 8 do
+        threads[id] = worker(share, id)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(effil.size(share), 8000)
+    test.equal(share["3_500"], 500)
+end
+
+test.shared_table.concurrent_reads_and_writes = function ()
+    local share = effil.table { counter = 0 }
+
+    local reader = effil.thread(function(tbl, count)
+        local previous = 0
+        for _ = 1, count do
+            local current = tbl.counter
+            if current < previous then
+                return false
+            end
+            previous = current
+        end
+        return true
+    end)
+    local writer = effil.thread(function(tbl, count)
+        for i = 1, count do
+            tbl.counter = i
+            tbl[i % 10] = i
+        end
+    end)
+
+    local readers = {}
+    for id = 1, 4 do
+        readers[id] = reader(share, 20000)
+    end
+    test.equal(writer(share, 5000):wait(), "completed")
+    for _, thr in ipairs(readers) do
+        test.equal(thr:get(), true)
+    end
+    test.equal(share.counter, 5000)
+end
+
+test.shared_table.bulk_operations = function ()
+    local share = effil.table(nil, { shards = 4 })
+    test.equal(effil.set_many(share, { name = "Alice", age = 42, nested = { key = "value" }, 10, 20 }), share)
+    test.equal(share.name, "Alice")
+    test.equal(share.nested.key, "value")
+    test.equal(#share, 2)
+
+    local values = effil.get_many(share, { "name", "age", "missing", 2 })
+    test.equal(values.name, "Alice")
+    test.equal(values.age, 42)
+    test.is_nil(values.missing)
+    test.equal(values[2], 20)
+
+    effil.update(share, function(entries)
+        entries.age = entries.age + 1
+        entries.name = nil
+    end)
+    test.equal(share.age, 43)
+    test.is_nil(share.name)
+    test.equal(share.nested.key, "value")
+
+    effil.update(share, function() return { replaced = true } end)
+    test.equal(effil.size(share), 1)
+    test.equal(share.replaced, true)
+
+    test.equal(pcall(effil.set_many, share, 1), false)
+    test.equal(pcall(effil.get_many, {}, {}), false)
+    test.equal(pcall(effil.update, share, {}), false)
+end
+
+test.shared_table.atomic_operations = function ()
+    local share = effil.table()
+    test.equal(effil.atomic_add(share, "counter"), 1)
+    test.equal(effil.atomic_add(share, "counter", 10), 11)
+    test.equal(effil.atomic_add(share, "counter", 0.5), 11.5)
+    test.equal(share.counter, 11.5)
+
+    share.name = "value"
+    test.equal(pcall(effil.atomic_add, share, "name", 1), false)
+    test.equal(pcall(effil.atomic_add, share, "counter", "1"), false)
+
+    test.is_true(effil.compare_and_swap(share, "flag", nil, true))
+    test.is_false(effil.compare_and_swap(share, "flag", nil, true))
+    test.is_true(effil.compare_and_swap(share, "flag", true, false))
+    test.equal(share.flag, false)
+    test.is_true(effil.compare_and_swap(share, "counter", 11.5, nil))
+    test.is_nil(share.counter)
+
+    local nested = effil.table()
+    share.nested = nested
+    test.is_true(effil.compare_and_swap(share, "nested", nested, "replaced"))
+    test.equal(share.nested, "replaced")
+
+    test.equal(effil.exchange(share, "name", "new"), "value")
+    test.equal(effil.exchange(share, "name", nil), "new")
+    test.is_nil(effil.exchange(share, "name", 1))
+    test.equal(share.name, 1)
+end
+
+test.shared_table.concurrent_atomic_add = function ()
+    local share = effil.table()
+    local worker = effil.thread(function(tbl, count)
+        local effil = require "effil"
+        for _ = 1, count do
+            effil.atomic_add(tbl, "counter")
+        end
+    end)
+
+    local threads = {}
+    for id = 1, 4 do
+        threads[id] = worker(share, 5000)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(share.counter, 20000)
+end
+
+test.shared_table.range = function ()
+    local share = effil.table()
+    for i = 1, 10 do
+        share[i] = i * 10
+    end
+    share[-1] = "negative"
+    share[2.5] = "fraction"
+    share[1000] = "far"
+    share.apple, share.banana, share.cherry = 1, 2, 3
+
+    local function collect(...)
+        local keys, values = {}, {}
+        for key, value in effil.range(...) do
+            keys[#keys + 1] = key
+            values[#values + 1] = value
+        end
+        return keys, values
+    end
+
+    local keys, values = collect(share, 2, 4)
+    test.equal(#keys, 4)
+    test.equal(keys[1], 2)
+    test.equal(keys[2], 2.5)
+    test.equal(values[2], "fraction")
+    test.equal(keys[4], 4)
+    test.equal(values[4], 40)
+
+    keys = collect(share, -100, 10000, 3)
+    test.equal(#keys, 3)
+    test.equal(keys[1], -1)
+    test.equal(keys[3], 2)
+
+    keys, values = collect(share, "b", "d")
+    test.equal(#keys, 2)
+    test.equal(keys[1], "banana")
+    test.equal(values[2], 3)
+
+    test.equal(#collect(share, 11, 999), 0)
+    test.equal(#collect(share, 5, 1), 0)
+    test.equal(#collect(share, 1, 10, 0), 0)
+
+    -- entries are taken at once
+    for key in effil.range(share, 1, 10) do
+        share[key] = nil
+    end
+    test.equal(#collect(share, 1, 10), 0)
+
+    test.equal(pcall(effil.range, {}, 1, 2), false)
+    test.equal(pcall(effil.range, share, 1, "2"), false)
+    test.equal(pcall(effil.range, share, true, false), false)
+    test.equal(pcall(effil.range, share, 0/0, 1), false)
+    test.equal(pcall(effil.range, share, 1, 2, -1), false)
+end
+
+test.shared_table.range_gc_objects = function ()
+    collectgarbage()
+    effil.gc.collect()
+    local initial = effil.gc.count()
+
+    local share = effil.table()
+    for i = 1, 10 do
+        share[i] = effil.table { id = i, parent = share }
+    end
+
+    -- entries taken by range stay alive after removal from the table
+    local iterator, cursor = effil.range(share, 1, 10)
+    for i = 1, 10 do
+        share[i] = nil
+    end
+    collectgarbage()
+    effil.gc.collect()
+    test.equal(effil.gc.count(), initial + 11)
+    local count = 0
+    for _, value in iterator, cursor do
+        count = count + 1
+        test.equal(value.id, count)
+    end
+    test.equal(count, 10)
+    iterator, cursor = nil, nil
+
+    -- range scan doesn't make values of the table GC roots
+    share[1] = effil.table { parent = share }
+    for _ in effil.range(share, 1, 1) do end
+    share = nil
+    collectgarbage()
+    effil.gc.collect()
+    test.equal(effil.gc.count(), initial)
+end
+
+test.shared_table.range_sharded = function ()
+    local share = effil.table(nil, { shards = 4 })
+    for i = 1, 100 do
+        share[i] = i
+        share["key" .. i] = i
+    end
+    local previous, count = 0, 0
+    for key, value in effil.range(share, 11, 90) do
+        test.is_true(key > previous)
+        test.equal(key, value)
+        previous, count = key, count + 1
+    end
+    test.equal(count, 80)
+end
+
+test.shared_table.range_index_updates = function ()
+    local share = effil.table(nil, { shards = 4 })
+    local start = 1700000000000
+    for i = 1, 1000 do
+        share[start + i * 1000 + 0.25] = i
+    end
+    share.name = "events"
+
+    local function window(low, high, limit)
+        local keys = {}
+        for key in effil.range(share, low, high, limit) do
+            keys[#keys + 1] = key
+        end
+        return keys
+    end
+
+    -- sparse keys, the first call builds the index
+    local keys = window(start + 100000, start + 110000)
+    test.equal(#keys, 10)
+    test.equal(keys[1], start + 100000 + 0.25)
+    test.equal(keys[10], start + 109000 + 0.25)
+
+    -- index follows modifications
+    share[start + 100500] = "inserted"
+    share[start + 101000 + 0.25] = nil
+    share[start + 102000 + 0.25] = "replaced"
+    keys = window(start + 100000, start + 110000)
+    test.equal(#keys, 10)
+    test.equal(keys[2], start + 100500)
+    test.equal(keys[3], start + 102000 + 0.25)
+    test.equal(share[keys[3]], "replaced")
+
+    keys = window(start + 100000, start + 110000, 2)
+    test.equal(#keys, 2)
+    test.equal(keys[2], start + 100500)
+
+    share.name = nil
+    share.other = "value"
+    keys = window("a", "z")
+    test.equal(#keys, 1)
+    test.equal(keys[1], "other")
+    test.equal(#window(start, start + 2000000), 1000)
+end
+
+test.shared_table.wait = function ()
+    local share = effil.table { flag = false, seen = false }
+
+    -- value differs from expected one
+    local changed, value = effil.wait(share, "flag", true)
+    test.is_true(changed)
+    test.is_false(value)
+    -- timeouts
+    changed, value = effil.wait(share, "flag", false, 0)
+    test.is_false(changed)
+    test.is_false(value)
+    test.is_false(effil.wait(share, "flag", nil, 10, "ms"))
+
+    local worker = effil.thread(function(tbl)
+        local effil = require "effil"
+        local changed, value = effil.wait(tbl, "flag", false)
+        tbl.seen = value
+        changed, value = effil.wait(tbl, "counter")
+        return changed, value
+    end)(share)
+
+    share.other = "doesn't wake the worker"
+    share.flag = true
+    test.is_true(effil.wait(share, "seen", false, 5))
+    test.equal(share.seen, true)
+    while worker:status() == "running" do
+        effil.atomic_add(share, "counter")
+        effil.sleep(10, "ms")
+    end
+    changed, value = worker:get()
+    test.is_true(changed)
+    test.is_true(value >= 1)
+
+    test.equal(pcall(effil.wait, {}, "flag"), false)
+    test.equal(pcall(effil.wait, share, nil), false)
+end
+
+test.shared_table.wait_interruption = function ()
+    local share = effil.table()
+    local worker = effil.thread(function(tbl)
+        require("effil").wait(tbl, "never")
+    end)(share)
+    effil.sleep(50, "ms")
+    test.is_true(worker:cancel(5))
+    test.equal(worker:status(), "canceled")
+
+    worker = effil.thread(function(tbl)
+        return require("effil").wait(tbl, "never")
+    end)(share)
+    effil.sleep(50, "ms")
+    effil.freeze(share)
+    test.equal(worker:get(5), false)
+end
+
+test.shared_table.freeze = function ()
+    local share = effil.table { key = "value", nested = { key = "value" }, 1, 2, 3 }
+    test.is_false(effil.is_frozen(share))
+    test.equal(effil.freeze(share), share)
+    test.is_true(effil.is_frozen(share))
+    test.is_false(effil.is_frozen(share.nested))
+
+    test.equal(share.key, "value")
+    test.equal(#share, 3)
+    local count = 0
+    for _, _ in effil.pairs(share) do
+        count = count + 1
+    end
+    test.equal(count, 5)
+
+    test.equal(pcall(function() share.key = "other" end), false)
+    test.equal(pcall(function() share[4] = 4 end), false)
+    test.equal(pcall(effil.rawset, share, "key", nil), false)
+    test.equal(pcall(effil.atomic_add, share, 1), false)
+    test.equal(pcall(effil.setmetatable, share, {}), false)
+    test.equal(share.key, "value")
+    test.equal(effil.size(share), 5)
+
+    share.nested.key = "other"
+    test.equal(share.nested.key, "other")
+
+    local mt = effil.table()
+    local cyclic = effil.setmetatable(effil.table(), mt)
+    cyclic.self = cyclic
+    cyclic.nested = effil.table()
+    effil.freeze(cyclic, true)
+    test.is_true(effil.is_frozen(cyclic.nested))
+    test.is_true(effil.is_frozen(mt))
+end
+
+test.shared_table.concurrent_update = function ()
+    local share = effil.table { counter = 0 }
+    local worker = effil.thread(function(tbl, count)
+        local effil = require "effil"
+        for _ = 1, count do
+            effil.update(tbl, function(entries) entries.counter = entries.counter + 1 end)
+        end
+    end)
+
+    local threads = {}
+    for id = 1, 4 do
+        threads[id] = worker(share, 500)
+    end
+    for _, thr in ipairs(threads) do
+        test.equal(thr:wait(), "completed")
+    end
+    test.equal(share.counter, 2000)
+end
+
+test.shared_table.update_contention = function ()
+    local share = effil.table { counter = 0, noise = 0 }
+    local writer = effil.thread(function(tbl)
+        while not tbl.stop do
+            tbl.noise = tbl.noise + 1
+        end
+    end)(share)
+
+    -- every optimistic attempt is outdated by the writer, so the last one is applied under the lock
+    local calls = 0
+    effil.update(share, function(entries)
+        calls = calls + 1
+        local finish = os.clock() + 0.005
+        while os.clock() < finish do end
+        entries.counter = entries.counter + 1
+    end)
+    share.stop = true
+    test.equal(writer:wait(), "completed")
+    test.equal(share.counter, 1)
+    test.is_true(calls <= 16)
+end
+
+test.shared_table.update_keeps_unchanged_entries = function ()
+    local share = effil.table { fn = function() return 1 end, counter = 0, ready = false }
+    local worker = effil.thread(function(tbl)
+        local effil = require "effil"
+        tbl.ready = true
+        return effil.wait(tbl, "fn", nil, 200, "ms")
+    end)(share)
+    test.is_true(effil.wait(share, "ready", false, 5))
+    effil.sleep(50, "ms")
+
+    effil.update(share, function(entries) entries.counter = entries.counter + 1 end)
+    test.equal(share.counter, 1)
+    test.equal(share.fn(), 1)
+    test.is_false(worker:get())
+end
+
+test.shared_table.update_frozen_concurrently = function ()
+    local share = effil.table { value = 1 }
+    local ok, err = pcall(effil.update, share, function(entries)
+        if not effil.is_frozen(share) then
+            effil.freeze(share)
+        end
+        entries.value = 2
+    end)
+    test.is_false(ok)
+    test.is_not_nil(string.find(err, "effil.update: attempt to modify frozen table", 1, true))
+    test.equal(share.value, 1)
+end
+
 test.shared_table.size = function ()
     local share = effil.table()
     test.equal(effil.size(share), 0)
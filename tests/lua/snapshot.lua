@@ -0,0 +1,118 @@
+require "bootstrap-tests"
+
+local snapshot_path = os.tmpname()
+
+test.snapshot.tear_down = function ()
+    os.remove(snapshot_path)
+    default_tear_down()
+end
+
+local function reload(tbl)
+    effil.save(tbl, snapshot_path)
+    return effil.load(snapshot_path)
+end
+
+test.snapshot.primitives = function ()
+    local loaded = reload(effil.table {
+        1, 2.5, "three", true, false,
+        key = "value", [-7] = "negative", [2^53] = "big", [0.5] = "half",
+        ["with\0zero"] = "binary\0string"
+    })
+    test.equal(effil.type(loaded), "effil.table")
+    test.equal(loaded[1], 1)
+    test.equal(loaded[2], 2.5)
+    test.equal(loaded[3], "three")
+    test.equal(loaded[4], true)
+    test.equal(loaded[5], false)
+    test.equal(effil.size(loaded), 10)
+    test.equal(loaded.key, "value")
+    test.equal(loaded[-7], "negative")
+    test.equal(loaded[2^53], "big")
+    test.equal(loaded[0.5], "half")
+    test.equal(loaded["with\0zero"], "binary\0string")
+end
+
+test.snapshot.shared_subtables = function ()
+    local shared = effil.table { value = 1 }
+    local tbl = effil.table { left = shared, right = shared }
+    tbl.self = tbl
+    tbl[shared] = "table key"
+
+    local loaded = reload(tbl)
+    test.equal(loaded.self, loaded)
+    test.equal(loaded.left, loaded.right)
+    test.not_equal(loaded.left, shared)
+    test.equal(loaded.left.value, 1)
+    test.equal(loaded[loaded.left], "table key")
+end
+
+test.snapshot.metatables = function ()
+    local mt = effil.table()
+    mt.__index = function(t, key) return key .. "!" end
+    local tbl = effil.setmetatable(effil.table(), mt)
+    effil.freeze(effil.table { tbl, mt }, true)
+
+    local loaded = reload(effil.table { tbl, effil.table { tbl } })
+    test.equal(loaded[1].hello, "hello!")
+    test.equal(loaded[1], loaded[2][1])
+    test.is_true(effil.is_frozen(loaded[1]))
+    test.is_true(effil.is_frozen(effil.getmetatable(loaded[1])))
+    test.is_false(effil.is_frozen(loaded))
+end
+
+test.snapshot.functions_and_arrays = function ()
+    local arr = effil.array("int64", { 1, -2, 3 })
+    local counter = effil.table { value = 10 }
+    local tbl = effil.table {
+        arr = arr,
+        same = arr,
+        add = function(delta)
+            counter.value = counter.value + delta
+            return counter.value
+        end,
+        counter = counter,
+        module = effil
+    }
+
+    local loaded = reload(tbl)
+    test.equal(effil.type(loaded.arr), "effil.array")
+    test.equal(tostring(loaded.arr), tostring(loaded.same))
+    test.equal(#loaded.arr, 3)
+    test.equal(loaded.arr[2], -2)
+    test.equal(loaded.add(5), 15)
+    test.equal(loaded.counter.value, 15)
+    test.equal(counter.value, 10)
+    test.equal(loaded.module.type(loaded), "effil.table")
+end
+
+test.snapshot.unsupported_values = function ()
+    test.equal(pcall(effil.save, {}, snapshot_path), false)
+    test.equal(pcall(effil.save, effil.table(), 1), false)
+    test.equal(pcall(effil.save, effil.table { effil.channel() }, snapshot_path), false)
+    test.equal(pcall(effil.save, effil.table { print }, snapshot_path), false)
+    test.equal(pcall(effil.load, 1), false)
+    test.equal(pcall(effil.load, snapshot_path .. ".missing"), false)
+end
+
+test.snapshot.failed_save_keeps_previous = function ()
+    effil.save(effil.table { key = "previous" }, snapshot_path)
+    test.equal(pcall(effil.save, effil.table { key = "next", effil.channel() }, snapshot_path), false)
+
+    local loaded = effil.load(snapshot_path)
+    test.equal(loaded.key, "previous")
+    test.is_nil(io.open(snapshot_path .. ".tmp", "rb"))
+end
+
+test.snapshot.corrupted_file = function ()
+    effil.save(effil.table { "value", key = effil.table { 1, 2, 3 } }, snapshot_path)
+    local file = io.open(snapshot_path, "rb")
+    local data = file:read("*a")
+    file:close()
+
+    for _, size in ipairs { 0, 4, math.floor(#data / 2), #data - 1 } do
+        file = io.open(snapshot_path, "wb")
+        file:write(data:sub(1, size))
+        file:close()
+        test.equal(pcall(effil.load, snapshot_path), false)
+    end
+end
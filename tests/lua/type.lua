@@ -10,6 +10,8 @@ test.type.check_all_types = function()
     test.equal(effil.type(function()end), "function")
     test.equal(effil.type(effil.table()), "effil.table")
     test.equal(effil.type(effil.channel()), "effil.channel")
+    test.equal(effil.type(effil.array("double", 1)), "effil.array")
+    test.equal(effil.type(effil.cache()), "effil.cache")
     local thr = effil.thread(function() end)()
     test.equal(effil.type(thr), "effil.thread")
     thr:wait()